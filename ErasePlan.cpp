@@ -0,0 +1,98 @@
+#include "ErasePlan.h"
+
+ErasePlan::ErasePlan() :
+    rangeCount(0),
+    rowCount(0),
+    rowSize(0),
+    maxRowsPerRange(0),
+    isPlanComplete(false)
+{
+    
+}
+
+void ErasePlan::clear(size_t rowSize, uint8_t maxRowsPerRange)
+{
+    this->rangeCount = 0;
+    this->rowCount = 0;
+    this->rowSize = rowSize;
+    this->maxRowsPerRange = maxRowsPerRange;
+    this->isPlanComplete = (rowSize != 0) && (maxRowsPerRange != 0);
+}
+
+int16_t ErasePlan::findRange(uint32_t address)
+{
+    for (size_t i = 0; i < rangeCount; i++) {
+        if ((address >= ranges[i].Address) && (address < ranges[i].Address + ranges[i].RowCount * rowSize)) {
+            return i;
+        }
+    }
+    
+    return -1;
+}
+
+size_t ErasePlan::getChangedRowCount()
+{
+    size_t count = 0;
+    
+    for (size_t i = 0; i < rangeCount; i++) {
+        if (ranges[i].IsChanged) {
+            count += ranges[i].RowCount;
+        }
+    }
+    
+    return count;
+}
+
+uint32_t ErasePlan::updateDigest(uint32_t digest, const uint8_t* data, size_t size)
+{
+    for (size_t i = 0; i < size; i++) {
+        digest = (digest ^ data[i]) * 16777619UL;
+    }
+    
+    return digest;
+}
+
+bool ErasePlan::addRow(uint32_t rowAddress, uint16_t rowChecksum, const uint8_t* rowData)
+{
+    if (!isPlanComplete) {
+        return false;
+    }
+    
+    if (rangeCount > 0) {
+        EraseRange& last = ranges[rangeCount - 1];
+        
+        // the image is mostly in ascending order, so this is the common case
+        if ((rowAddress == last.Address + last.RowCount * rowSize) && (last.RowCount < maxRowsPerRange)) {
+            last.RowCount++;
+            last.Checksum += rowChecksum;
+            
+            // the row follows the others of the range, so the digest simply continues
+            if (rowData) {
+                last.Digest = updateDigest(last.Digest, rowData, rowSize);
+            }
+            rowCount++;
+            
+            return true;
+        }
+        
+        if (findRange(rowAddress) >= 0) {
+            return true;
+        }
+    }
+    
+    if (rangeCount >= ERASE_PLAN_MAX_RANGES) {
+        isPlanComplete = false;
+        
+        return false;
+    }
+    
+    ranges[rangeCount].Address = rowAddress;
+    ranges[rangeCount].RowCount = 1;
+    ranges[rangeCount].Checksum = rowChecksum;
+    ranges[rangeCount].Digest = rowData ? updateDigest(ERASE_PLAN_DIGEST_BASIS, rowData, rowSize) : ERASE_PLAN_DIGEST_BASIS;
+    ranges[rangeCount].IsChanged = true;
+    rangeCount++;
+    rowCount++;
+    
+    return true;
+}
@@ -0,0 +1,54 @@
+#ifndef _ERASE_PLAN_H_
+#define _ERASE_PLAN_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define ERASE_PLAN_MAX_RANGES 80
+#define ERASE_PLAN_DIGEST_BASIS 2166136261UL // the digest of no data at all (FNV-1a)
+
+struct EraseRange {
+    uint32_t Address;
+    uint8_t RowCount;
+    uint16_t Checksum; // of the image data over the whole range, as calculated by the bootloader
+    uint32_t Digest; // of the image data in address order, unlike the checksum it depends on the order of the words
+    bool IsChanged; // false if the device already holds the image data of the range
+};
+
+// Collects the erase rows used by an image and merges contiguous rows into
+// ranges, so that they can be erased with a minimal number of EraseFlash commands.
+class ErasePlan
+{
+    public:
+        ErasePlan();
+        
+        void clear(size_t rowSize, uint8_t maxRowsPerRange);
+        
+        // rows that are already part of the plan are ignored, the digest of a range only
+        // covers the data of its rows if it is given for every row (see updateDigest())
+        // returns false if the plan ran out of ranges (it is not complete anymore)
+        bool addRow(uint32_t rowAddress, uint16_t rowChecksum, const uint8_t* rowData = 0);
+        
+        // FNV-1a over the given data, continuing from the given digest
+        static uint32_t updateDigest(uint32_t digest, const uint8_t* data, size_t size);
+        
+        // returns the index of the range holding the address, or -1 if there is none
+        int16_t findRange(uint32_t address);
+        void setChanged(size_t index, bool isChanged) { ranges[index].IsChanged = isChanged; };
+        size_t getChangedRowCount();
+        
+        bool isComplete() const { return isPlanComplete; };
+        size_t getRangeCount() const { return rangeCount; };
+        const EraseRange& getRange(size_t index) const { return ranges[index]; };
+        size_t getRowCount() const { return rowCount; };
+        size_t getRowSize() const { return rowSize; };
+    private:
+        EraseRange ranges[ERASE_PLAN_MAX_RANGES];
+        size_t rangeCount;
+        size_t rowCount;
+        size_t rowSize;
+        uint8_t maxRowsPerRange;
+        bool isPlanComplete;
+};
+
+#endif
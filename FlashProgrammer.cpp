@@ -0,0 +1,651 @@
+#include "FlashProgrammer.h"
+
+#define DEBUG_SYMBOLS_ON
+
+#ifdef DEBUG_SYMBOLS_ON
+#define debugPrintln(...) { if (this->diagStream) this->diagStream->println(__VA_ARGS__); }
+#define debugPrint(...) { if (this->diagStream) this->diagStream->print(__VA_ARGS__); }
+#warning "Debug mode is ON"
+#else
+#define debugPrintln(...)
+#define debugPrint(...)
+#endif
+
+FlashProgrammer::FlashProgrammer() :
+    bootloader(0),
+    parser(0),
+    diagStream(0),
+    shouldEraseBlocks(true),
+    retries(FLASH_PROGRAMMER_DEFAULT_RETRIES),
+    eraseRowSize(0),
+    writeLatchSize(0),
+    pageSize(0),
+    writeChunkSize(0),
+    isErasePlanExecuted(false),
+    checkpointCallback(0),
+    completedRangeCount(0),
+    eraseCommandCount(0),
+    writeCommandCount(0),
+    checksumCommandCount(0),
+    readCommandCount(0),
+    retryCount(0),
+    resyncFailureCount(0),
+    fillingSlot(0),
+    isWritePending(false)
+{
+    static_assert(FLASH_PROGRAMMER_WRITE_SLOTS >= 2, "A slot has to be filled while another one is written!");
+    
+    for (size_t i = 0; i < FLASH_PROGRAMMER_WRITE_SLOTS; i++) {
+        writeSlots[i].Address = 0;
+        writeSlots[i].Length = 0;
+    }
+}
+
+void FlashProgrammer::init(Sodaq_RN2483Bootloader& bootloader, IntelHexParser& parser)
+{
+    this->bootloader = &bootloader;
+    this->parser = &parser;
+}
+
+bool FlashProgrammer::configureGeometry(const BootloaderVersionInfo& versionInfo)
+{
+    pageSize = 0;
+    isErasePlanExecuted = false;
+    writeSlots[fillingSlot].Length = 0;
+    isWritePending = false;
+    
+    size_t reportedEraseRowSize = versionInfo.EraseRowSize;
+    size_t reportedWriteLatchSize = versionInfo.WriteLatchSize;
+    
+    debugPrint("[configureGeometry] erase row: ");
+    debugPrint(reportedEraseRowSize);
+    debugPrint(", write latch: ");
+    debugPrintln(reportedWriteLatchSize);
+    
+    // an erase row has to consist of whole write latches, otherwise writing a page
+    // could never line up with what has been erased
+    if ((reportedEraseRowSize == 0) || (reportedWriteLatchSize == 0)
+            || (reportedEraseRowSize % reportedWriteLatchSize != 0)
+            || (reportedWriteLatchSize > FLASH_PROGRAMMER_MAX_WRITE_SIZE)) {
+        debugPrintln("The reported flash geometry is invalid!");
+        return false;
+    }
+    
+    // a page is exactly one erase row: erasing at the start of a page can never wipe data
+    // that was already written as part of the previous page, and nothing outside of the rows
+    // used by the image is touched (fewer commands are a matter of the erase plan)
+    if (!parser->setPageSize(reportedEraseRowSize)) {
+        debugPrintln("The erase row does not fit in the page buffer!");
+        return false;
+    }
+    
+    eraseRowSize = reportedEraseRowSize;
+    writeLatchSize = reportedWriteLatchSize;
+    pageSize = reportedEraseRowSize;
+    
+    writeChunkSize = Sodaq_RN2483Bootloader::getMaxWriteSize(versionInfo, FLASH_PROGRAMMER_MAX_WRITE_SIZE);
+    
+    debugPrint("Page size: ");
+    debugPrint(pageSize);
+    debugPrint(", write chunk size: ");
+    debugPrintln(writeChunkSize);
+    
+    return true;
+}
+
+// also starts a new programming session as far as the command counters are concerned
+void FlashProgrammer::beginErasePlan(bool isIncremental)
+{
+    erasePlan.clear(eraseRowSize, isIncremental ? FLASH_PROGRAMMER_INCREMENTAL_REGION_ROWS : FLASH_PROGRAMMER_MAX_ERASE_ROWS);
+    resetUpdateState();
+}
+
+bool FlashProgrammer::reuseErasePlan()
+{
+    if (!isGeometryConfigured() || (erasePlan.getRowSize() != eraseRowSize) || (erasePlan.getRowCount() == 0)) {
+        debugPrintln("There is no plan for the erase row size of the device!");
+        return false;
+    }
+    
+    // the previous update may have found some of the ranges unchanged
+    for (size_t i = 0; i < erasePlan.getRangeCount(); i++) {
+        erasePlan.setChanged(i, true);
+    }
+    
+    resetUpdateState();
+    
+    return true;
+}
+
+void FlashProgrammer::resetUpdateState()
+{
+    isErasePlanExecuted = false;
+    completedRangeCount = 0;
+    
+    eraseCommandCount = 0;
+    writeCommandCount = 0;
+    checksumCommandCount = 0;
+    readCommandCount = 0;
+    retryCount = 0;
+    resyncFailureCount = 0;
+}
+
+bool FlashProgrammer::planPage(uint32_t startingAddress, const uint8_t* buffer, size_t size)
+{
+    // the whole page is written, so all of its rows have to be erased
+    for (size_t offset = 0; offset < size; offset += eraseRowSize) {
+        uint16_t rowChecksum = Sodaq_RN2483Bootloader::calculateChecksum(buffer + offset, eraseRowSize);
+        size_t rangeCount = erasePlan.getRangeCount();
+        
+        if (!erasePlan.addRow(startingAddress + offset, rowChecksum, buffer + offset)) {
+            debugPrintln("The erase plan ran out of ranges!");
+            return false;
+        }
+        
+        // a new range starts with this page
+        if (erasePlan.getRangeCount() > rangeCount) {
+            rangePositions[rangeCount] = parser->getPagePosition();
+        }
+    }
+    
+    return true;
+}
+
+bool FlashProgrammer::executeErasePlan()
+{
+    if (!isGeometryConfigured() || !erasePlan.isComplete()) {
+        debugPrintln("There is no complete erase plan to execute!");
+        return false;
+    }
+    
+    // adjacent changed ranges are merged again, up to the maximum number of rows per command
+    uint32_t eraseAddress = 0;
+    uint8_t eraseRowCount = 0;
+    
+    for (size_t i = 0; i < erasePlan.getRangeCount(); i++) {
+        const EraseRange& range = erasePlan.getRange(i);
+        
+        if (!range.IsChanged) {
+            continue;
+        }
+        
+        if ((eraseRowCount > 0) && (range.Address == eraseAddress + eraseRowCount * eraseRowSize)
+                && (eraseRowCount + range.RowCount <= FLASH_PROGRAMMER_MAX_ERASE_ROWS)) {
+            eraseRowCount += range.RowCount;
+            continue;
+        }
+        
+        if ((eraseRowCount > 0) && !eraseRows(eraseAddress, eraseRowCount)) {
+            return false;
+        }
+        
+        eraseAddress = range.Address;
+        eraseRowCount = range.RowCount;
+    }
+    
+    if ((eraseRowCount > 0) && !eraseRows(eraseAddress, eraseRowCount)) {
+        return false;
+    }
+    
+    // the pages don't need to be erased anymore when they are started
+    isErasePlanExecuted = true;
+    
+    return true;
+}
+
+bool FlashProgrammer::getDeviceChecksum(const EraseRange& range, uint16_t& checksum)
+{
+    if (!waitForPendingWrite()) {
+        return false;
+    }
+    
+    for (uint8_t attempt = 0; attempt <= retries; attempt++) {
+        if (attempt > 0) {
+            prepareRetry(attempt);
+        }
+        
+        checksumCommandCount++;
+        
+        if (bootloader->getChecksum(range.Address, range.RowCount * eraseRowSize, checksum)) {
+            return true;
+        }
+        
+        debugPrint("Failed to get the checksum of the range starting at 0x");
+        debugPrintln(range.Address, HEX);
+    }
+    
+    return false;
+}
+
+bool FlashProgrammer::compareWithDevice()
+{
+    if (!erasePlan.isComplete()) {
+        debugPrintln("There is no complete plan to compare with!");
+        return false;
+    }
+    
+    for (size_t i = 0; i < erasePlan.getRangeCount(); i++) {
+        const EraseRange& range = erasePlan.getRange(i);
+        
+        // the user ID and configuration words can't be compared, so they are always updated
+        if (!range.IsChanged || (range.Address >= RN2483_BOOTLOADER_PROGRAM_MEMORY_END)) {
+            continue;
+        }
+        
+        uint16_t deviceChecksum;
+        
+        if (!getDeviceChecksum(range, deviceChecksum)) {
+            return false;
+        }
+        
+        if (deviceChecksum != range.Checksum) {
+            continue;
+        }
+        
+        uint32_t deviceDigest;
+        
+        if (!getDeviceDigest(range, deviceDigest)) {
+            return false;
+        }
+        
+        erasePlan.setChanged(i, deviceDigest != range.Digest);
+    }
+    
+    return true;
+}
+
+bool FlashProgrammer::getDeviceDigest(const EraseRange& range, uint32_t& digest)
+{
+    uint8_t buffer[FLASH_PROGRAMMER_MAX_READ_SIZE];
+    size_t readSize = min(writeChunkSize, (size_t)FLASH_PROGRAMMER_MAX_READ_SIZE);
+    uint32_t endAddress = range.Address + range.RowCount * eraseRowSize;
+    
+    digest = ERASE_PLAN_DIGEST_BASIS;
+    
+    for (uint32_t address = range.Address; address < endAddress; address += readSize) {
+        uint8_t length = min((uint32_t)readSize, endAddress - address);
+        bool isRead = false;
+        
+        for (uint8_t attempt = 0; (attempt <= retries) && !isRead; attempt++) {
+            if (attempt > 0) {
+                prepareRetry(attempt);
+            }
+            
+            readCommandCount++;
+            isRead = bootloader->readFlash(address, length, buffer);
+        }
+        
+        if (!isRead) {
+            debugPrint("Failed to read the flash at 0x");
+            debugPrintln(address, HEX);
+            
+            return false;
+        }
+        
+        digest = ErasePlan::updateDigest(digest, buffer, length);
+    }
+    
+    return true;
+}
+
+bool FlashProgrammer::resumeFrom(size_t completedRangeCount)
+{
+    if (!erasePlan.isComplete() || (completedRangeCount == 0) || (completedRangeCount > erasePlan.getRangeCount())) {
+        debugPrintln("There is nothing to resume from!");
+        return false;
+    }
+    
+    // the boundary: the last completed range that can be compared (the ranges before it have been written before it),
+    // the user ID and configuration words can't be, so a checkpoint has to include a range of program memory
+    size_t boundaryIndex = completedRangeCount;
+    
+    while ((boundaryIndex > 0) && (erasePlan.getRange(boundaryIndex - 1).Address >= RN2483_BOOTLOADER_PROGRAM_MEMORY_END)) {
+        boundaryIndex--;
+    }
+    
+    if (boundaryIndex == 0) {
+        debugPrintln("The checkpoint cannot be verified!");
+        return false;
+    }
+    
+    const EraseRange& boundary = erasePlan.getRange(boundaryIndex - 1);
+    uint16_t deviceChecksum;
+    uint32_t deviceDigest;
+    
+    // the flash could have been changed since the checkpoint, so the checksum alone is not trusted
+    if (!getDeviceChecksum(boundary, deviceChecksum) || (deviceChecksum != boundary.Checksum)
+            || !getDeviceDigest(boundary, deviceDigest) || (deviceDigest != boundary.Digest)) {
+        debugPrintln("The device does not hold the range of the checkpoint!");
+        return false;
+    }
+    
+    for (size_t i = 0; i < completedRangeCount; i++) {
+        erasePlan.setChanged(i, false);
+    }
+    
+    this->completedRangeCount = completedRangeCount;
+    
+    return true;
+}
+
+ImagePosition FlashProgrammer::getStartPosition()
+{
+    if (erasePlan.isComplete()) {
+        for (size_t i = 0; i < erasePlan.getRangeCount(); i++) {
+            if (erasePlan.getRange(i).IsChanged) {
+                return rangePositions[i];
+            }
+        }
+    }
+    
+    ImagePosition start = { 0, 0, 0 };
+    
+    return start;
+}
+
+// the pages are written in the order of the image, and so are the ranges planned,
+// so all the ranges before the one holding the end of the write are complete
+void FlashProgrammer::onWriteAcknowledged(uint32_t startingAddress, size_t size)
+{
+    if (!erasePlan.isComplete()) {
+        return;
+    }
+    
+    uint32_t lastAddress = startingAddress + size - 1;
+    int16_t rangeIndex = erasePlan.findRange(lastAddress);
+    
+    if (rangeIndex < 0) {
+        return;
+    }
+    
+    const EraseRange& range = erasePlan.getRange(rangeIndex);
+    size_t count = (lastAddress == range.Address + range.RowCount * eraseRowSize - 1) ? rangeIndex + 1 : rangeIndex;
+    
+    if (count > completedRangeCount) {
+        completedRangeCount = count;
+        
+        if (checkpointCallback) {
+            checkpointCallback(completedRangeCount);
+        }
+    }
+}
+
+bool FlashProgrammer::isPageChanged(uint32_t startingAddress)
+{
+    int16_t rangeIndex = erasePlan.findRange(startingAddress);
+    
+    // pages outside of the plan are always written
+    return (rangeIndex < 0) || erasePlan.getRange(rangeIndex).IsChanged;
+}
+
+bool FlashProgrammer::verifyFlash()
+{
+    if (!erasePlan.isComplete()) {
+        debugPrintln("There is no complete plan to verify against!");
+        return false;
+    }
+    
+    for (size_t i = 0; i < erasePlan.getRangeCount(); i++) {
+        const EraseRange& range = erasePlan.getRange(i);
+        
+        // the user ID and configuration words don't read back as they were written
+        if (range.Address >= RN2483_BOOTLOADER_PROGRAM_MEMORY_END) {
+            continue;
+        }
+        
+        uint16_t deviceChecksum;
+        
+        if (!getDeviceChecksum(range, deviceChecksum)) {
+            return false;
+        }
+        
+        if (deviceChecksum != range.Checksum) {
+            debugPrint("Checksum mismatch for the range starting at 0x");
+            debugPrint(range.Address, HEX);
+            debugPrint(": 0x");
+            debugPrint(deviceChecksum, HEX);
+            debugPrint(" instead of 0x");
+            debugPrintln(range.Checksum, HEX);
+            
+            return false;
+        }
+    }
+    
+    return true;
+}
+
+bool FlashProgrammer::eraseRows(uint32_t startingAddress, uint8_t rowCount)
+{
+    if (!waitForPendingWrite()) {
+        return false;
+    }
+    
+    for (uint8_t attempt = 0; attempt <= retries; attempt++) {
+        if (attempt > 0) {
+            prepareRetry(attempt);
+        }
+        
+        eraseCommandCount++;
+        
+        if (bootloader->eraseFlash(startingAddress, rowCount)) {
+            debugPrint("Successfully erased ");
+            debugPrint(rowCount);
+            debugPrint(" row(s) starting at 0x");
+            debugPrintln(startingAddress, HEX);
+            
+            return true;
+        }
+        
+        debugPrint("Failed to erase ");
+        debugPrint(rowCount);
+        debugPrint(" row(s) starting at 0x");
+        debugPrintln(startingAddress, HEX);
+    }
+    
+    return false;
+}
+
+// the bootloader may have lost a byte of the last frame (and still be waiting for the rest of it),
+// or its response may have been garbled, so wait until it has given up and check that it responds
+void FlashProgrammer::prepareRetry(uint8_t attempt)
+{
+    uint32_t backoffMS = min((uint32_t)FLASH_PROGRAMMER_RETRY_BACKOFF_MS << (attempt - 1), (uint32_t)FLASH_PROGRAMMER_MAX_RETRY_BACKOFF_MS);
+    
+    debugPrint("Retrying (attempt ");
+    debugPrint(attempt);
+    debugPrint(") after ");
+    debugPrint(backoffMS);
+    debugPrintln(" ms");
+    
+    retryCount++;
+    
+    if (!bootloader->resynchronize(backoffMS)) {
+        resyncFailureCount++;
+    }
+}
+
+bool FlashProgrammer::startPage(uint32_t startingAddress)
+{
+    if (!isGeometryConfigured()) {
+        debugPrintln("The flash geometry has not been configured!");
+        return false;
+    }
+    
+    if (shouldEraseBlocks && !isErasePlanExecuted) {
+        return eraseRows(startingAddress, 1);
+    }
+    
+    return true;
+}
+
+// a retried write first erases the rows of the chunk again when it covers them completely, as the
+// failed attempt may have programmed garbage (programming can only clear bits)
+bool FlashProgrammer::writeChunk(uint32_t startingAddress, const uint8_t* buffer, size_t size, uint8_t firstAttempt)
+{
+    if (!waitForPendingWrite()) {
+        return false;
+    }
+    
+    bool isChunkOfRows = (eraseRowSize != 0) && (startingAddress % eraseRowSize == 0) && (size % eraseRowSize == 0);
+    
+    for (uint8_t attempt = firstAttempt; attempt <= retries; attempt++) {
+        if (attempt > 0) {
+            prepareRetry(attempt);
+            
+            if (shouldEraseBlocks && isChunkOfRows) {
+                eraseCommandCount++;
+                
+                if (!bootloader->eraseFlash(startingAddress, size / eraseRowSize)) {
+                    continue;
+                }
+            }
+        }
+        
+        writeCommandCount++;
+        
+        if (bootloader->writeFlash(startingAddress, buffer, size)) {
+            debugPrint("Successfully wrote ");
+            debugPrint(size);
+            debugPrint(" bytes starting at 0x");
+            debugPrintln(startingAddress, HEX);
+            
+            onWriteAcknowledged(startingAddress, size);
+            
+            return true;
+        }
+        
+        debugPrint("Failed to write ");
+        debugPrint(size);
+        debugPrint(" bytes starting at 0x");
+        debugPrintln(startingAddress, HEX);
+    }
+    
+    return false;
+}
+
+// sends the filling slot without waiting for the response, and moves on to the next slot
+bool FlashProgrammer::sendWriteSlot()
+{
+    WriteSlot& slot = writeSlots[fillingSlot];
+    
+    if (slot.Length == 0) {
+        return true;
+    }
+    
+    if (!waitForPendingWrite()) {
+        return false;
+    }
+    
+    writeCommandCount++;
+    
+    if (!bootloader->beginWriteFlash(slot.Address, slot.Data, slot.Length)) {
+        debugPrint("Failed to send ");
+        debugPrint(slot.Length);
+        debugPrint(" bytes starting at 0x");
+        debugPrintln(slot.Address, HEX);
+        
+        slot.Length = 0;
+        
+        return false;
+    }
+    
+    isWritePending = true;
+    fillingSlot = (fillingSlot + 1) % FLASH_PROGRAMMER_WRITE_SLOTS;
+    writeSlots[fillingSlot].Length = 0;
+    
+    return true;
+}
+
+// the slot before the filling one is the one in flight
+bool FlashProgrammer::waitForPendingWrite()
+{
+    if (!isWritePending) {
+        return true;
+    }
+    
+    isWritePending = false;
+    
+    WriteSlot& slot = writeSlots[(fillingSlot + FLASH_PROGRAMMER_WRITE_SLOTS - 1) % FLASH_PROGRAMMER_WRITE_SLOTS];
+    
+    if (bootloader->finishWriteFlash()) {
+        debugPrint("Successfully wrote ");
+        debugPrint(slot.Length);
+        debugPrint(" bytes starting at 0x");
+        debugPrintln(slot.Address, HEX);
+        
+        onWriteAcknowledged(slot.Address, slot.Length);
+        
+        return true;
+    }
+    
+    debugPrint("Failed to write ");
+    debugPrint(slot.Length);
+    debugPrint(" bytes starting at 0x");
+    debugPrintln(slot.Address, HEX);
+    
+    // the slot is kept until the write has been acknowledged, so it can simply be sent again
+    return writeChunk(slot.Address, slot.Data, slot.Length, 1);
+}
+
+// adjacent pages are collected in a write slot, so that each WriteFlash
+// command (and its ACK round-trip) covers as many write latches as possible
+bool FlashProgrammer::completePage(uint32_t startingAddress, const uint8_t* buffer, size_t size)
+{
+    // the device already holds the data of the unchanged ranges
+    if (isErasePlanExecuted && !isPageChanged(startingAddress)) {
+        return true;
+    }
+    
+    WriteSlot* slot = &writeSlots[fillingSlot];
+    
+    if ((slot->Length > 0)
+            && ((startingAddress != slot->Address + slot->Length) || (slot->Length + size > writeChunkSize))) {
+        if (!sendWriteSlot()) {
+            return false;
+        }
+        
+        slot = &writeSlots[fillingSlot];
+    }
+    
+    // pages that cannot be coalesced (larger than a chunk) are written as they are
+    if (size > writeChunkSize) {
+        for (size_t offset = 0; offset < size; offset += writeChunkSize) {
+            if (!writeChunk(startingAddress + offset, buffer + offset, min(writeChunkSize, size - offset))) {
+                return false;
+            }
+        }
+        
+        return true;
+    }
+    
+    if (slot->Length == 0) {
+        slot->Address = startingAddress;
+    }
+    
+    memcpy(&slot->Data[slot->Length], buffer, size);
+    slot->Length += size;
+    
+    if (slot->Length == writeChunkSize) {
+        return sendWriteSlot();
+    }
+    
+    return true;
+}
+
+bool FlashProgrammer::finishPages()
+{
+    if (!sendWriteSlot() || !waitForPendingWrite()) {
+        return false;
+    }
+    
+    // the ranges at the end that didn't need to be written are complete as well
+    if (erasePlan.isComplete() && (completedRangeCount < erasePlan.getRangeCount())) {
+        completedRangeCount = erasePlan.getRangeCount();
+        
+        if (checkpointCallback) {
+            checkpointCallback(completedRangeCount);
+        }
+    }
+    
+    return true;
+}
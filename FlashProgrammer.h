@@ -0,0 +1,165 @@
+#ifndef _FLASH_PROGRAMMER_H_
+#define _FLASH_PROGRAMMER_H_
+
+#include "Arduino.h"
+#include "RN2483Bootloader.h"
+#include "IntelHexParser.h"
+#include "ErasePlan.h"
+
+// the number of rows per EraseFlash command is bounded by the response timeout, as
+// the bootloader only answers once all rows have been erased (a few ms per row)
+#define FLASH_PROGRAMMER_MAX_ERASE_ROWS 64
+
+// the ranges of an incremental update are smaller, so that a change only costs its surrounding region
+#define FLASH_PROGRAMMER_INCREMENTAL_REGION_ROWS 16
+
+// a range whose checksum matches is read back in parts of up to this size (as far as a write would fit a packet),
+// to confirm that it holds the data of the image in the right order (see compareWithDevice())
+#define FLASH_PROGRAMMER_MAX_READ_SIZE 128
+
+// adjacent pages are coalesced into WriteFlash commands of up to this size, as far as the maximum packet
+// size reported by the bootloader allows (see Sodaq_RN2483Bootloader::getMaxWriteSize())
+#define FLASH_PROGRAMMER_MAX_WRITE_SIZE 256
+
+// the chunks are collected in a ring of write slots: while the WriteFlash command of one slot
+// waits for its response, the parser already fills the next one (a single command is in flight)
+#define FLASH_PROGRAMMER_WRITE_SLOTS 2
+
+// a failed erase/write/checksum command is retried this many times by default, after re-synchronizing
+// with the bootloader; the line has to be idle for the backoff time first, which doubles per attempt
+#define FLASH_PROGRAMMER_DEFAULT_RETRIES 3
+#define FLASH_PROGRAMMER_RETRY_BACKOFF_MS 100
+#define FLASH_PROGRAMMER_MAX_RETRY_BACKOFF_MS 800
+
+// reports the progress of the live pass as the number of leading ranges of the plan that the device
+// now holds completely (all of them once the update has finished), to be persisted for resumeFrom()
+typedef void (*CheckpointCallback)(size_t completedRangeCount);
+
+struct WriteSlot {
+    uint8_t Data[FLASH_PROGRAMMER_MAX_WRITE_SIZE];
+    uint32_t Address;
+    size_t Length;
+};
+
+// Drives the bootloader from the page callbacks of the IntelHexParser, using
+// the flash geometry reported by the device (see configureGeometry()).
+class FlashProgrammer
+{
+    public:
+        FlashProgrammer();
+        
+        void init(Sodaq_RN2483Bootloader& bootloader, IntelHexParser& parser);
+        
+        void setDiag(Stream& stream) { diagStream = &stream; };
+        
+        void setEraseBlocks(bool shouldEraseBlocks) { this->shouldEraseBlocks = shouldEraseBlocks; };
+        
+        // 0 to fail on the first failed command
+        void setRetries(uint8_t retries) { this->retries = retries; };
+        
+        // sizes the parser pages and the write chunks from the device geometry,
+        // returns false if the geometry is not usable (nothing should be programmed then)
+        bool configureGeometry(const BootloaderVersionInfo& versionInfo);
+        
+        bool isGeometryConfigured() { return pageSize != 0; };
+        size_t getEraseRowSize() { return eraseRowSize; };
+        size_t getWriteLatchSize() { return writeLatchSize; };
+        size_t getPageSize() { return pageSize; };
+        size_t getWriteChunkSize() { return writeChunkSize; };
+        
+        // erase planning: clear the plan, add every page of the image (see IntelHexParser::scanImage())
+        // and then erase all the planned rows up front with as few commands as possible
+        // an incremental plan uses smaller ranges, to be compared with the device (see compareWithDevice())
+        void beginErasePlan(bool isIncremental = false);
+        
+        // starts another update with the plan that has already been scanned, e.g. ahead of time with the geometry the
+        // device is expected to report; returns false (the image has to be scanned again) if it was made for another row size
+        bool reuseErasePlan();
+        bool planPage(uint32_t startingAddress, const uint8_t* buffer, size_t size);
+        bool executeErasePlan();
+        
+        // compares the device checksum of every planned range in program memory with the
+        // checksum of the image data, which takes a single command per range
+        bool verifyFlash();
+        
+        // marks the planned ranges that the device already holds as unchanged, using one checksum command per range
+        // (that is still marked as changed); the additive checksum doesn't notice words or rows in the wrong order, so
+        // a match is confirmed by reading the range back and comparing its digest; unchanged ranges are then neither
+        // erased nor written. This only pays off for a module that holds most of the image already (e.g. an update that
+        // was interrupted), a module that has just been erased would only be read for nothing.
+        bool compareWithDevice();
+        
+        // resuming an interrupted update, with the plan of the same image: checks that the device holds the last
+        // range reported as completed (see setCheckpointCallback()), by its checksum and its digest as
+        // compareWithDevice() does, and then marks all those ranges as unchanged; the plan is left as it was on failure
+        void setCheckpointCallback(CheckpointCallback cb) { checkpointCallback = cb; };
+        bool resumeFrom(size_t completedRangeCount);
+        
+        // the position of the image the live pass can start at: that of the first range that is still to be written
+        // (the pages before it would be skipped anyway), or the start of the image without a plan
+        ImagePosition getStartPosition();
+        uint32_t getChecksumCommandCount() { return checksumCommandCount; };
+        uint32_t getReadCommandCount() { return readCommandCount; };
+        ErasePlan& getErasePlan() { return erasePlan; };
+        
+        uint32_t getEraseCommandCount() { return eraseCommandCount; };
+        uint32_t getWriteCommandCount() { return writeCommandCount; };
+        
+        // the commands that have been retried, and the re-synchronizations that got no response
+        uint32_t getRetryCount() { return retryCount; };
+        uint32_t getResyncFailureCount() { return resyncFailureCount; };
+        
+        // to be called from the IntelHexParser page callbacks
+        bool startPage(uint32_t startingAddress);
+        bool completePage(uint32_t startingAddress, const uint8_t* buffer, size_t size);
+        
+        // writes out the pages that are still waiting to be coalesced and waits for the last write
+        // to be acknowledged, to be called once the image has been parsed
+        bool finishPages();
+    private:
+        Sodaq_RN2483Bootloader* bootloader;
+        IntelHexParser* parser;
+        
+        Stream* diagStream;
+        
+        bool shouldEraseBlocks;
+        uint8_t retries;
+        
+        size_t eraseRowSize;
+        size_t writeLatchSize;
+        size_t pageSize;
+        size_t writeChunkSize;
+        
+        ErasePlan erasePlan;
+        bool isErasePlanExecuted;
+        
+        // the position of the first page of each range, as recorded by planPage()
+        ImagePosition rangePositions[ERASE_PLAN_MAX_RANGES];
+        
+        CheckpointCallback checkpointCallback;
+        size_t completedRangeCount;
+        
+        uint32_t eraseCommandCount;
+        uint32_t writeCommandCount;
+        uint32_t checksumCommandCount;
+        uint32_t readCommandCount;
+        uint32_t retryCount;
+        uint32_t resyncFailureCount;
+        
+        WriteSlot writeSlots[FLASH_PROGRAMMER_WRITE_SLOTS];
+        uint8_t fillingSlot; // the slot the pages are collected in
+        bool isWritePending; // the previous slot has been sent, its response has not been read yet
+        
+        void resetUpdateState();
+        bool eraseRows(uint32_t startingAddress, uint8_t rowCount);
+        bool getDeviceChecksum(const EraseRange& range, uint16_t& checksum);
+        bool getDeviceDigest(const EraseRange& range, uint32_t& digest);
+        bool isPageChanged(uint32_t startingAddress);
+        void prepareRetry(uint8_t attempt);
+        void onWriteAcknowledged(uint32_t startingAddress, size_t size);
+        bool writeChunk(uint32_t startingAddress, const uint8_t* buffer, size_t size, uint8_t firstAttempt = 0);
+        bool sendWriteSlot();
+        bool waitForPendingWrite();
+};
+
+#endif
@@ -18,7 +18,16 @@
 //#define HEXFILE_RN2903_SA_AU_103
 //#define HEXFILE_RN2903_AS923_105
 
-#if defined(HEXFILE_RN2483_101)
+// Or select a packed image generated by extras/tools/hex2image.py (see Readme.md), e.g.
+//#define HEXFILE_PACKED "PackedFileImageRN2483_105.h"
+
+// Each image also defines HexFileImageVersion: the start of the banner its application
+// sends after "sys reset" (device, version and build date), e.g. "RN2483 1.0.5 Oct 31 2018".
+// A module that already sends it is not updated.
+
+#if defined(HEXFILE_PACKED)
+#include HEXFILE_PACKED
+#elif defined(HEXFILE_RN2483_101)
 #include "HexFileImage2483_101.h"
 #elif defined(HEXFILE_RN2483_103)
 #include "HexFileImage2483_103.h"
@@ -2,7 +2,8 @@
 #define HEXFILEIMAGE2483_H__
 
 #define HexFileImage RN2483_101
-const char* const RN2483_101[] = { 
+#define HexFileImageVersion "RN2483 1.0.1 Dec 15 2015"
+constexpr const char* RN2483_101[] = { 
     ":10030000F5EF01F0FFFFFFFFE1CF28F0E2CF29F08A",
     ":10031000D9CF2AF0DACF2BF0F3CF2CF0F4CF2DF099",
     ":10032000F6CF2EF0F7CF2FF0F8CF30F0F5CF31F039",
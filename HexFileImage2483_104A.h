@@ -2,7 +2,8 @@
 #define HEXFILEIMAGE2483_H__
 
 #define HexFileImage RN2483_104A
-const char* const RN2483_104A[] = { 
+#define HexFileImageVersion "RN2483 1.0.4A Feb 13 2018"
+constexpr const char* RN2483_104A[] = { 
     ":10030000D7EF01F0FFFFFFFF5A82FACF2AF0FBCFB1",
 ":100310002BF0D9CF2CF0DACF2DF0F3CF2EF0F4CF95",
 ":100320002FF0F2BC9DA005D09EA003D0C2EC74F0CB",
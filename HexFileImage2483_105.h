@@ -2,7 +2,8 @@
 #define HEXFILEIMAGE2483_H__
 
 #define HexFileImage RN2483_105
-const char* const RN2483_105[] = {
+#define HexFileImageVersion "RN2483 1.0.5 Oct 31 2018"
+constexpr const char* RN2483_105[] = {
 ":10030000DFEF01F0FFFFFFFFFACF2AF0FBCF2BF06A",
 ":10031000E1CF2CF0E2CF2DF0D9CF2EF0DACF2FF0B5",
 ":10032000F3CF30F0F4CF31F01DEEA8F0F2BC9DA079",
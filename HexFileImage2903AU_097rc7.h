@@ -2,7 +2,8 @@
 #define HEXFILEIMAGE2903AU_097RC7_H__
 
 #define HexFileImage RN2903AU_097rc7
-const char* const RN2903AU_097rc7[] = { 
+#define HexFileImageVersion "RN2903AU 0.9.7rc7 Aug 11 2016"
+constexpr const char* RN2903AU_097rc7[] = { 
     ":10030000F7EF01F0FFFFFFFF5A82E1CF28F0E2CFC5",
     ":1003100029F0D9CF2AF0DACF2BF0F3CF2CF0F4CF9D",
     ":100320002DF0F6CF2EF0F7CF2FF0F8CF30F0F5CF3D",
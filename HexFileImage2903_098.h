@@ -2,7 +2,8 @@
 #define HEXFILEIMAGE2903AU_098_H__
 
 #define HexFileImage RN2903_098
-const char* const RN2903_098[] = { 
+#define HexFileImageVersion "RN2903 0.9.8 Feb 14 2017"
+constexpr const char* RN2903_098[] = { 
     ":10030000D7EF01F0FFFFFFFF5A82FACF2AF0FBCFB1",
 ":100310002BF0D9CF2CF0DACF2DF0F3CF2EF0F4CF95",
 ":100320002FF0F2BC9DA005D09EA003D04AEC6CF04B",
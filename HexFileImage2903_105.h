@@ -2,7 +2,8 @@
 #define HEXFILEIMAGE2905_H__
 
 #define HexFileImage RN2903_105
-const char* const RN2903_105[] = { 
+#define HexFileImageVersion "RN2903 1.0.5 Nov 06 2018"
+constexpr const char* RN2903_105[] = { 
 ":100300000FEF02F0FFFFFFFFFACF06F0FBCF07F081",
 ":10031000E1CF08F0E2CF09F0D9CF0AF0DACF0BF045",
 ":10032000F3CF0CF0F4CF0DF037C00EF038C00FF063",
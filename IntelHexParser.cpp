@@ -14,7 +14,6 @@
 #endif
 
 #define HEX_QUAD_TO_UINT16(LSBh, LSBl, MSBh, MSBl) ((HEX_PAIR_TO_BYTE(MSBh, MSBl) << 8) + (HEX_PAIR_TO_BYTE(LSBh, LSBl)))
-#define BYTES_TO_UINT16(LSB, MSB) (MSB << 8 | LSB)
 
 
 const uint8_t RecordColonOffset = 0;
@@ -36,36 +35,162 @@ enum RecordType {
     StartLinearAddressRecord = 0x05
 };
 
+#ifndef HEXFILE_PACKED
+
+// Compile-time validation of the selected HexFileImage.
+// These mirror the checks of parseLine(), so that a corrupt image fails the build
+// instead of the verification pass. They are limited to a single return statement
+// each (C++11 constexpr) and recurse by halves over the image to keep the depth low.
+
+constexpr bool isHexChar(char c)
+{
+    return ((c >= '0') && (c <= '9')) || ((c >= 'A') && (c <= 'F'));
+}
+
+constexpr size_t constexprStrlen(const char* str)
+{
+    return (*str == 0) ? 0 : 1 + constexprStrlen(str + 1);
+}
+
+constexpr bool areHexChars(const char* str, size_t length)
+{
+    return (length == 0) || (isHexChar(str[0]) && areHexChars(str + 1, length - 1));
+}
+
+constexpr uint8_t hexByteAt(const char* line, size_t offset)
+{
+    return HEX_PAIR_TO_BYTE(line[offset], line[offset + 1]);
+}
+
+// sums up the bytes of the line starting at offset, including the checksum field
+constexpr uint8_t recordSum(const char* line, size_t offset, size_t lineLength)
+{
+    return (offset >= lineLength) ? 0 : (uint8_t)(hexByteAt(line, offset) + recordSum(line, offset + 2, lineLength));
+}
+
+constexpr bool isSupportedRecordType(uint8_t recordType)
+{
+    return (recordType == DataRecord) || (recordType == EndOfFileRecord)
+           || (recordType == ExtendedSegmentAddressRecord) || (recordType == ExtendedLinearAddressRecord);
+}
+
+constexpr bool isRecordValid(const char* line, size_t lineLength)
+{
+    return (lineLength >= LineSizeWithoutData) && (lineLength <= MaxLineSize)
+           && (line[RecordColonOffset] == ':')
+           && areHexChars(line + RecordLengthOffset, lineLength - 1)
+           && (lineLength == (size_t)(LineSizeWithoutData + 2 * hexByteAt(line, RecordLengthOffset)))
+           && isSupportedRecordType(hexByteAt(line, RecordTypeOffset))
+           && (recordSum(line, RecordLengthOffset, lineLength) == 0);
+}
+
+constexpr bool areRecordsValid(const char* const* lines, size_t count)
+{
+    return (count == 0) ? true
+           : (count == 1) ? isRecordValid(lines[0], constexprStrlen(lines[0]))
+           : areRecordsValid(lines, count / 2) && areRecordsValid(lines + count / 2, count - count / 2);
+}
+
+constexpr bool isEndOfFileRecord(const char* line)
+{
+    return (line[RecordColonOffset] == ':') && (hexByteAt(line, RecordTypeOffset) == EndOfFileRecord);
+}
+
+static_assert(areRecordsValid(HexFileImage, ARRAY_SIZE(HexFileImage)),
+              "The selected HexFileImage contains an invalid record (format, length, type or checksum)!");
+static_assert(isEndOfFileRecord(HexFileImage[ARRAY_SIZE(HexFileImage) - 1]),
+              "The selected HexFileImage does not end with an End Of File record!");
+
+#endif
+
 IntelHexParser::IntelHexParser(size_t pageSize) :
     diagStream(0),
     extendedAddressOffset(0),
     isBufferInitialized(0),
     isLive(0),
     pageSize(0),
+    pageAlignMask(0),
     pageBuffer(0),
+    pageBufferSize(0),
     pageStartAddress(0),
     isPageDirty(0),
+    isPageStarted(0),
+    currentPosition(),
+    pagePosition(),
     pageStartCallback(0),
     progressCallback(0),
-    pageCompleteCallback(0)
+    pageCompleteCallback(0),
+    pageScanCallback(0),
+    yieldCallback(0),
+    yieldIntervalMS(INTEL_HEX_PARSER_DEFAULT_YIELD_INTERVAL),
+    lastYieldMS(0)
 {
     this->pageSize = pageSize;
     
+    if ((pageSize & (pageSize - 1)) == 0) {
+        this->pageAlignMask = ~(uint32_t)(pageSize - 1);
+    }
+    
     // make sure the buffer is only initialized once
     if (!isBufferInitialized) {
         this->pageBuffer = static_cast<uint8_t*>(malloc(this->pageSize));
+        this->pageBufferSize = this->pageSize;
         
         isBufferInitialized = true;
     }
 }
 
+IntelHexParser::IntelHexParser(size_t pageSize, uint8_t* staticPageBuffer) :
+    diagStream(0),
+    extendedAddressOffset(0),
+    isBufferInitialized(true),
+    isLive(0),
+    pageSize(pageSize),
+    pageAlignMask(~(uint32_t)(pageSize - 1)),
+    pageBuffer(staticPageBuffer),
+    pageBufferSize(pageSize),
+    pageStartAddress(0),
+    isPageDirty(0),
+    isPageStarted(0),
+    currentPosition(),
+    pagePosition(),
+    pageStartCallback(0),
+    progressCallback(0),
+    pageCompleteCallback(0),
+    pageScanCallback(0),
+    yieldCallback(0),
+    yieldIntervalMS(INTEL_HEX_PARSER_DEFAULT_YIELD_INTERVAL),
+    lastYieldMS(0)
+{
+}
+
+bool IntelHexParser::setPageSize(size_t pageSize)
+{
+    if ((pageSize == 0) || (pageSize > pageBufferSize)) {
+        return false;
+    }
+    
+    this->pageSize = pageSize;
+    this->pageAlignMask = ((pageSize & (pageSize - 1)) == 0) ? ~(uint32_t)(pageSize - 1) : 0;
+    this->isPageStarted = false;
+    this->isPageDirty = false;
+    
+    return true;
+}
+
 // start from an address that is a multiple of the page size and contains the target address
 // updates the pageStartAddress
 bool IntelHexParser::startNewPage(uint32_t startingAddress)
 {
     memset(pageBuffer, 0xFF, pageSize);
     
-    pageStartAddress = trunc(startingAddress / pageSize) * pageSize; // find the "enclosing page" starting address
+    // find the "enclosing page" starting address, masking instead of dividing for power of two page sizes
+    if (pageAlignMask != 0) {
+        pageStartAddress = startingAddress & pageAlignMask;
+    }
+    else {
+        pageStartAddress = startingAddress - (startingAddress % pageSize);
+    }
     
     debugPrint("startNewPage(0x");
     debugPrint(startingAddress, HEX);
@@ -73,6 +198,10 @@ bool IntelHexParser::startNewPage(uint32_t startingAddress)
     debugPrintln(pageStartAddress, HEX);
     
     isPageDirty = false;
+    isPageStarted = true;
+    
+    pagePosition = currentPosition;
+    pagePosition.ExtendedAddressOffset = extendedAddressOffset;
     
     if (isLive && pageStartCallback != 0) {
         return pageStartCallback(pageStartAddress);
@@ -90,6 +219,10 @@ bool IntelHexParser::completePage()
         return pageCompleteCallback(pageStartAddress, const_cast<const uint8_t*>(pageBuffer), pageSize);
     }
     
+    if (!isLive && isPageDirty && pageScanCallback != 0) {
+        return pageScanCallback(pageStartAddress, const_cast<const uint8_t*>(pageBuffer), pageSize);
+    }
+    
     return true;
 }
 
@@ -174,7 +307,7 @@ bool IntelHexParser::parseLine(const char* line)
                 for (uint8_t i = 0; i < recordLength; i++) {
                     uint32_t targetAddress = startAddress + i;
                     
-                    if (targetAddress < pageStartAddress || targetAddress > pageStartAddress + pageSize - 1) {
+                    if (!isPageStarted || targetAddress < pageStartAddress || targetAddress > pageStartAddress + pageSize - 1) {
                         if (!completePage()) {
                             debugPrintln("The Callback to complete the current page failed!");
                             return false;
@@ -257,27 +390,191 @@ void IntelHexParser::setPageCompleteCallback(PageCompleteCallback cb)
     pageCompleteCallback = cb;
 }
 
-bool IntelHexParser::verifyImageIntegrity()
+void IntelHexParser::setYieldCallback(YieldCallback cb, uint32_t intervalMS)
 {
-    isLive = false;
-    return iterateThroughImage();
+    yieldCallback = cb;
+    yieldIntervalMS = intervalMS;
+}
+
+// time-sliced instead of per line/chunk: progress reporting and yielding
+// are far more expensive than parsing a single line
+void IntelHexParser::yieldIfDue(size_t current, size_t total, bool force)
+{
+    if (force || (millis() - lastYieldMS >= yieldIntervalMS)) {
+        lastYieldMS = millis();
+        
+        reportProgress(current, total);
+        
+        if (yieldCallback != 0) {
+            yieldCallback();
+        }
+    }
 }
 
 bool IntelHexParser::parseImage()
+{
+    ImagePosition start = { 0, 0, 0 };
+    
+    return parseImageFrom(start);
+}
+
+bool IntelHexParser::parseImageFrom(const ImagePosition& position)
 {
     isLive = true;
-    return iterateThroughImage();
+    return iterateThroughImage(position);
 }
 
-bool IntelHexParser::iterateThroughImage()
+bool IntelHexParser::scanImage(PageCompleteCallback cb)
 {
-    extendedAddressOffset = 0;
+    isLive = false;
+    pageScanCallback = cb;
+    
+    ImagePosition start = { 0, 0, 0 };
+    bool result = iterateThroughImage(start);
+    
+    pageScanCallback = 0;
+    
+    return result;
+}
+
+#ifdef HEXFILE_PACKED
+
+static uint32_t crc32Update(uint32_t crc, uint8_t b)
+{
+    crc ^= b;
+    
+    for (uint8_t i = 0; i < 8; i++) {
+        crc = (crc >> 1) ^ (0xEDB88320UL & (0 - (crc & 1)));
+    }
+    
+    return crc;
+}
+
+static uint32_t crc32UpdateUint32(uint32_t crc, uint32_t value)
+{
+    for (uint8_t i = 0; i < 4; i++) {
+        crc = crc32Update(crc, (uint8_t)(value >> (i * 8)));
+    }
+    
+    return crc;
+}
+
+// the packed image carries a digest over all segments (see PackedImage.h)
+bool IntelHexParser::verifyImageIntegrity()
+{
+    const PackedImage& image = HexFileImage;
+    uint32_t crc = 0xFFFFFFFFUL;
+    
+    for (size_t i = 0; i < image.SegmentCount; i++) {
+        const PackedImageSegment& segment = image.Segments[i];
+        
+        if (segment.Offset + segment.Length > image.DataSize) {
+            debugPrintln("A segment of the packed image is out of bounds!");
+            return false;
+        }
+        
+        crc = crc32UpdateUint32(crc, segment.Address);
+        crc = crc32UpdateUint32(crc, segment.Length);
+        
+        for (size_t j = 0; j < segment.Length; j++) {
+            crc = crc32Update(crc, image.Data[segment.Offset + j]);
+        }
+        
+        yieldIfDue(segment.Offset, image.DataSize, (i == 0));
+    }
+    
+    yieldIfDue(image.DataSize - 1, image.DataSize, true);
+    
+    if ((crc ^ 0xFFFFFFFFUL) != image.Digest) {
+        debugPrintln("The packed image digest does not match!");
+        return false;
+    }
+    
+    return true;
+}
+
+// feeds the pages straight from the raw segment bytes, there are no records to decode
+// (a position is a segment and the offset within it)
+bool IntelHexParser::iterateThroughImage(const ImagePosition& start)
+{
+    const PackedImage& image = HexFileImage;
+    size_t doneBytes = 0;
+    
+    isPageStarted = false;
+    isPageDirty = false;
+    
+    if ((start.Line < image.SegmentCount) && (start.LineOffset < image.Segments[start.Line].Length)) {
+        doneBytes = image.Segments[start.Line].Offset + start.LineOffset;
+    }
+    
+    yieldIfDue(doneBytes, image.DataSize, true);
+    
+    for (size_t i = start.Line; i < image.SegmentCount; i++) {
+        const PackedImageSegment& segment = image.Segments[i];
+        uint32_t skipped = (i == start.Line) ? min(start.LineOffset, segment.Length) : 0;
+        const uint8_t* data = image.Data + segment.Offset + skipped;
+        uint32_t address = segment.Address + skipped;
+        uint32_t remaining = segment.Length - skipped;
+        
+        while (remaining > 0) {
+            currentPosition.Line = i;
+            currentPosition.LineOffset = address - segment.Address;
+            
+            if (!isPageStarted || address < pageStartAddress || address > pageStartAddress + pageSize - 1) {
+                if (!completePage()) {
+                    debugPrintln("The Callback to complete the current page failed!");
+                    return false;
+                }
+                
+                if (!startNewPage(address)) {
+                    debugPrintln("The Callback to start a new page failed!");
+                    return false;
+                }
+            }
+            
+            uint32_t chunkSize = min(remaining, pageStartAddress + pageSize - address);
+            memcpy(&pageBuffer[address - pageStartAddress], data, chunkSize);
+            isPageDirty = true;
+            
+            address += chunkSize;
+            data += chunkSize;
+            remaining -= chunkSize;
+            doneBytes += chunkSize;
+            
+            yieldIfDue(doneBytes - 1, image.DataSize, false);
+        }
+    }
+    
+    if (!completePage()) {
+        debugPrintln("The Callback to complete the current page failed!");
+        return false;
+    }
+    
+    yieldIfDue(image.DataSize - 1, image.DataSize, true);
+    
+    return true;
+}
+
+#else
+
+// every record of the image has already been validated at compile time (see the static_asserts above)
+bool IntelHexParser::verifyImageIntegrity()
+{
+    return true;
+}
+
+bool IntelHexParser::iterateThroughImage(const ImagePosition& start)
+{
+    extendedAddressOffset = start.ExtendedAddressOffset;
+    isPageStarted = false;
+    isPageDirty = false; // the last page of a previous pass has already been completed
     
     size_t totalLines = ARRAY_SIZE(HexFileImage);
     
-    for (size_t i = 0; i < totalLines; i++) {
-        reportProgress(i, totalLines);
-        delay(1);
+    for (size_t i = start.Line; i < totalLines; i++) {
+        yieldIfDue(i, totalLines, (i == start.Line) || (i == totalLines - 1));
+        
+        currentPosition.Line = i;
         
         if (!parseLine(HexFileImage[i])) {
             debugPrintln("Failure!");
@@ -288,3 +585,5 @@ bool IntelHexParser::iterateThroughImage()
     
     return true;
 }
+
+#endif
@@ -6,6 +6,18 @@
 typedef bool (*PageStartCallback)(uint32_t startingAddress);
 typedef void (*ProgressCallback)(size_t currentLine, size_t totalLines);
 typedef bool (*PageCompleteCallback)(uint32_t startingAddress, const uint8_t* buffer, size_t size);
+typedef void (*YieldCallback)();
+
+// a position in the image that a page was started at, to resume the iteration from: the line
+// (the segment of a packed image) and the state of the parser at that point
+struct ImagePosition {
+    size_t Line;
+    uint32_t LineOffset; // only used by the packed image, where a page can start within a segment
+    uint32_t ExtendedAddressOffset;
+};
+
+// the image iteration hands control back (progress + yield) at most once per interval
+#define INTEL_HEX_PARSER_DEFAULT_YIELD_INTERVAL 50
 
 class IntelHexParser
 {
@@ -14,13 +26,34 @@ class IntelHexParser
         
         void setDiag(Stream& stream) { diagStream = &stream; };
         
+        // the page size can be changed up to the size of the page buffer allocated at construction
+        bool setPageSize(size_t pageSize);
+        size_t getPageSize() { return pageSize; };
+        size_t getMaxPageSize() { return pageBufferSize; };
+        
         void setProgressCallback(ProgressCallback cb);
         void setPageStartCallback(PageStartCallback cb);
         void setPageCompleteCallback(PageCompleteCallback cb);
+        void setYieldCallback(YieldCallback cb, uint32_t intervalMS = INTEL_HEX_PARSER_DEFAULT_YIELD_INTERVAL);
         
         bool verifyImageIntegrity();
         bool parseImage();
+        
+        // a live pass that starts at the given position (see getPagePosition()) instead of the start of the image;
+        // a line that also holds the end of the preceding page reports that end as a page of its own
+        bool parseImageFrom(const ImagePosition& position);
+        
+        // the position the current page was started at, valid in the page callbacks
+        const ImagePosition& getPagePosition() { return pagePosition; };
+        
+        // a pass that only reports the completed (dirty) pages to the given callback,
+        // the page start/complete callbacks are not called
+        bool scanImage(PageCompleteCallback cb);
     protected:
+        // used by StaticIntelHexParser to hand over its statically allocated page buffer
+        IntelHexParser(size_t pageSize, uint8_t* staticPageBuffer);
+        
+
         Stream* diagStream;
         
         uint32_t extendedAddressOffset;
@@ -29,20 +62,43 @@ class IntelHexParser
         
         bool isLive;
         size_t pageSize;
+        uint32_t pageAlignMask; // only set when the page size is a power of two
         uint8_t* pageBuffer;
+        size_t pageBufferSize;
         uint32_t pageStartAddress;
         bool isPageDirty;
+        bool isPageStarted;
+        
+        ImagePosition currentPosition; // of the line being parsed
+        ImagePosition pagePosition;
         
         PageStartCallback pageStartCallback;
         ProgressCallback progressCallback;
         PageCompleteCallback pageCompleteCallback;
+        PageCompleteCallback pageScanCallback;
+        YieldCallback yieldCallback;
+        uint32_t yieldIntervalMS;
+        uint32_t lastYieldMS;
         
         bool startNewPage(uint32_t startingAddress);
         bool completePage();
         void reportProgress(size_t currentLine, size_t totalLines);
+        void yieldIfDue(size_t current, size_t total, bool force);
         void writeToPage(uint32_t targetAddress, uint8_t b);
         bool parseLine(const char* line);
-        bool iterateThroughImage();
+        bool iterateThroughImage(const ImagePosition& start);
+};
+
+// IntelHexParser with a compile-time, power of two page size and a statically allocated page buffer
+template<size_t PageSize>
+class StaticIntelHexParser : public IntelHexParser
+{
+    static_assert((PageSize != 0) && ((PageSize & (PageSize - 1)) == 0), "The page size must be a power of two!");
+    
+    public:
+        StaticIntelHexParser() : IntelHexParser(PageSize, staticPageBuffer) { };
+    private:
+        uint8_t staticPageBuffer[PageSize];
 };
 
 #endif
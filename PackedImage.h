@@ -0,0 +1,30 @@
+/*
+ * PackedImage.h
+ *
+ * Layout of the packed firmware images generated by extras/tools/hex2image.py.
+ * The raw bytes of each contiguous address range are stored back to back,
+ * so the parser can feed pages without decoding any hex records.
+ */
+
+#ifndef PACKEDIMAGE_H_
+#define PACKEDIMAGE_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+struct PackedImageSegment {
+    uint32_t Address; // base address of the segment in the module's flash
+    uint32_t Length; // number of bytes in the segment
+    uint32_t Offset; // offset of the first byte of the segment in PackedImage::Data
+};
+
+struct PackedImage {
+    const PackedImageSegment* Segments;
+    size_t SegmentCount;
+    const uint8_t* Data;
+    size_t DataSize;
+    // CRC-32 over the address (LE), length (LE) and data of every segment, in order
+    uint32_t Digest;
+};
+
+#endif /* PACKEDIMAGE_H_ */
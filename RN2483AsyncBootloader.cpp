@@ -0,0 +1,169 @@
+#include "RN2483AsyncBootloader.h"
+
+#define DEBUG_SYMBOLS_ON
+
+#ifdef DEBUG_SYMBOLS_ON
+#define debugPrintLn(...) { if (this->diagStream) this->diagStream->println(__VA_ARGS__); }
+#define debugPrint(...) { if (this->diagStream) this->diagStream->print(__VA_ARGS__); }
+#warning "Debug mode is ON"
+#else
+#define debugPrintLn(...)
+#define debugPrint(...)
+#endif
+
+Sodaq_RN2483AsyncBootloader::Sodaq_RN2483AsyncBootloader() :
+    loraStream(0),
+    diagStream(0),
+    completionCallback(0),
+    state(AsyncIdle),
+    command(0),
+    timeoutMS(0),
+    sentMS(0),
+    txData(0),
+    txDataLength(0),
+    txOffset(0),
+    rxLength(0),
+    rxExpected(0)
+{
+    
+}
+
+void Sodaq_RN2483AsyncBootloader::init(Uart& stream)
+{
+    this->loraStream = &stream;
+    this->state = AsyncIdle;
+}
+
+bool Sodaq_RN2483AsyncBootloader::submit(uint8_t command, uint16_t length, uint32_t address, const uint8_t* data, uint32_t timeoutMS)
+{
+    if (!loraStream || (state != AsyncIdle)) {
+        debugPrintLn("[submit] a command is still in flight!");
+        return false;
+    }
+    
+    // the module resets without responding, anything else echoes the header first
+    size_t expected = 0;
+    
+    if (command != ResetDeviceCommand) {
+        expected = sizeof(BootloaderRecord) + Sodaq_RN2483Bootloader::getResponseDataLength(command, length);
+    }
+    
+    if (expected > sizeof(rxBuffer)) {
+        debugPrintLn("[submit] the response cannot fit in the buffer!");
+        return false;
+    }
+    
+    Sodaq_RN2483Bootloader::encodeCommand(header, command, length, address);
+    
+    this->command = command;
+    this->timeoutMS = timeoutMS;
+    this->txData = data;
+    this->txDataLength = data ? length : 0;
+    this->txOffset = 0;
+    this->rxLength = 0;
+    this->rxExpected = expected;
+    
+    // anything that is still pending can't be part of this response
+    while (loraStream->available() > 0) {
+        loraStream->read();
+    }
+    
+    state = AsyncSending;
+    poll();
+    
+    return true;
+}
+
+void Sodaq_RN2483AsyncBootloader::poll()
+{
+    if (state == AsyncSending) {
+        send();
+    }
+    
+    if (state == AsyncReceiving) {
+        receive();
+    }
+}
+
+void Sodaq_RN2483AsyncBootloader::send()
+{
+    size_t total = sizeof(header) + txDataLength;
+    size_t slice = min(total - txOffset, (size_t)RN2483_ASYNC_BOOTLOADER_TX_SLICE);
+    
+    // the slice is written in bulk, in (at most) two parts: the rest of the header and the data
+    if (txOffset < sizeof(header)) {
+        size_t size = min(slice, sizeof(header) - txOffset);
+        
+        loraStream->write(&header[txOffset], size);
+        txOffset += size;
+        slice -= size;
+    }
+    
+    if (slice > 0) {
+        loraStream->write(&txData[txOffset - sizeof(header)], slice);
+        txOffset += slice;
+    }
+    
+    if (txOffset < total) {
+        return;
+    }
+    
+    sentMS = millis();
+    
+    if (rxExpected == 0) {
+        complete(BootloaderCommandSucceeded);
+    }
+    else {
+        state = AsyncReceiving;
+    }
+}
+
+void Sodaq_RN2483AsyncBootloader::receive()
+{
+    while ((rxLength < rxExpected) && (loraStream->available() > 0)) {
+        rxBuffer[rxLength++] = loraStream->read();
+    }
+    
+    if (rxLength < rxExpected) {
+        if (millis() - sentMS > timeoutMS) {
+            debugPrint("[receive] timed out after ");
+            debugPrint(rxLength);
+            debugPrintLn(" byte(s)");
+            
+            complete(BootloaderCommandTimedOut);
+        }
+        
+        return;
+    }
+    
+    // the header is echoed
+    if ((rxBuffer[1] != header[1]) || (memcmp(&rxBuffer[6], &header[6], 4) != 0)) {
+        debugPrintLn("[receive] the response does not match the command!");
+        
+        complete(BootloaderCommandInvalidResponse);
+        return;
+    }
+    
+    // commands that only respond with a status report 1 for success
+    bool hasStatus = (command == WriteFlashCommand) || (command == EraseFlashCommand)
+                     || (command == WriteEeCommand) || (command == WriteConfigurationWordsCommand);
+    
+    if (hasStatus && (rxBuffer[sizeof(BootloaderRecord)] != 1)) {
+        complete(BootloaderCommandFailed);
+        return;
+    }
+    
+    complete(BootloaderCommandSucceeded);
+}
+
+void Sodaq_RN2483AsyncBootloader::complete(BootloaderCommandResult result)
+{
+    // idle before the callback, so that it can submit the next command
+    state = AsyncIdle;
+    
+    if (completionCallback) {
+        size_t size = (rxLength > sizeof(BootloaderRecord)) ? rxLength - sizeof(BootloaderRecord) : 0;
+        
+        completionCallback(command, result, &rxBuffer[sizeof(BootloaderRecord)], size);
+    }
+}
@@ -0,0 +1,91 @@
+// RN2483AsyncBootloader.h
+
+#ifndef RN2483ASYNCBOOTLOADER_H_
+#define RN2483ASYNCBOOTLOADER_H_
+
+#include "Arduino.h"
+#include "RN2483Bootloader.h"
+
+// the time a response has to be complete in, after the command has been sent
+#define RN2483_ASYNC_BOOTLOADER_DEFAULT_TIMEOUT 1000
+
+// at most this many bytes are handed to the UART per poll(), which bounds the time
+// spent in write() (the SAMD UART blocks once its few bytes of buffering are full)
+#define RN2483_ASYNC_BOOTLOADER_TX_SLICE 16
+
+// the largest response that can be received (the header and the version info)
+#define RN2483_ASYNC_BOOTLOADER_RX_BUFFER_SIZE (sizeof(BootloaderRecord) + RN2483_BOOTLOADER_VERSION_INFO_SIZE)
+
+enum BootloaderCommandResult {
+    BootloaderCommandSucceeded,
+    BootloaderCommandFailed, // the bootloader reported an error status
+    BootloaderCommandTimedOut,
+    BootloaderCommandInvalidResponse
+};
+
+// called from poll() once a command has completed; the response data (without the echoed header)
+// is only valid during the call, and the next command can already be submitted from it
+typedef void (*BootloaderCompletionCallback)(uint8_t command, BootloaderCommandResult result, const uint8_t* data, size_t size);
+
+// A bootloader client that never waits: a command is submitted, and poll() (to be called
+// from the main loop) sends it in slices, collects the response and reports the completion.
+// Only one command is in flight at a time, as the bootloader handles them one by one.
+class Sodaq_RN2483AsyncBootloader
+{
+    public:
+        Sodaq_RN2483AsyncBootloader();
+        
+        void init(Uart& stream);
+        
+        void setDiag(Stream& stream) { diagStream = &stream; };
+        
+        void setCompletionCallback(BootloaderCompletionCallback cb) { completionCallback = cb; };
+        
+        bool isBusy() { return state != AsyncIdle; };
+        
+        // returns false if a command is still in flight, or if its response would not fit
+        // the data (WriteFlash and the like) is sent from the given buffer, which has to stay
+        // unchanged until the command has completed
+        bool submit(uint8_t command, uint16_t length = 0, uint32_t address = 0, const uint8_t* data = 0,
+                    uint32_t timeoutMS = RN2483_ASYNC_BOOTLOADER_DEFAULT_TIMEOUT);
+        
+        bool submitGetVersionInfo() { return submit(GetVersionInfoCommand); };
+        bool submitWriteFlash(uint32_t startingAddress, const uint8_t* buffer, uint16_t size) { return submit(WriteFlashCommand, size, startingAddress, buffer); };
+        bool submitEraseFlash(uint32_t address, uint8_t blockCount, uint32_t timeoutMS = RN2483_ASYNC_BOOTLOADER_DEFAULT_TIMEOUT) { return submit(EraseFlashCommand, blockCount, address, 0, timeoutMS); };
+        bool submitGetChecksum(uint32_t address, uint16_t length) { return submit(CalculateChecksumCommand, length, address); };
+        bool submitReset() { return submit(ResetDeviceCommand); };
+        
+        void poll();
+    private:
+        enum AsyncState {
+            AsyncIdle,
+            AsyncSending,
+            AsyncReceiving
+        };
+        
+        Uart* loraStream;
+        
+        Stream* diagStream;
+        
+        BootloaderCompletionCallback completionCallback;
+        
+        AsyncState state;
+        uint8_t command;
+        uint32_t timeoutMS;
+        uint32_t sentMS;
+        
+        uint8_t header[sizeof(BootloaderRecord)];
+        const uint8_t* txData;
+        size_t txDataLength;
+        size_t txOffset;
+        
+        uint8_t rxBuffer[RN2483_ASYNC_BOOTLOADER_RX_BUFFER_SIZE];
+        size_t rxLength;
+        size_t rxExpected;
+        
+        void send();
+        void receive();
+        void complete(BootloaderCommandResult result);
+};
+
+#endif
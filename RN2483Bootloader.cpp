@@ -1,5 +1,6 @@
 #include "RN2483Bootloader.h"
 #include "Sodaq_wdt.h"
+#include "Utils.h"
 #include <math.h>
 
 #define DEBUG_SYMBOLS_ON
@@ -16,9 +17,15 @@
 Sodaq_RN2483Bootloader::Sodaq_RN2483Bootloader():
     loraStream(0),
     diagStream(0),
+    sessionBaudRate(0),
+    lastCommand(0),
+    lastCommandLength(0),
+    lastCommandMicros(0),
+    lastResponseMicros(0),
+    isAdaptingTimeouts(true),
     inputBufferSize(RN2483_BOOTLOADER_INPUT_BUFFER_SIZE)
 {
-
+    clearCommandStats();
 }
 
 void Sodaq_RN2483Bootloader::initBootloader(Uart& stream)
@@ -26,6 +33,114 @@ void Sodaq_RN2483Bootloader::initBootloader(Uart& stream)
     debugPrintLn("[initBootloader]");
     
     this->loraStream = &stream;
+    
+    clearCommandStats();
+}
+
+void Sodaq_RN2483Bootloader::switchBaudRate(uint32_t baudRate)
+{
+    debugPrint("[switchBaudRate] ");
+    debugPrintLn(baudRate);
+    
+    this->loraStream->flush();
+    this->loraStream->end();
+    this->loraStream->begin(baudRate);
+    sodaq_wdt_safe_delay(10);
+    
+    // drop anything received at the previous rate
+    while (this->loraStream->available() > 0) {
+        this->loraStream->read();
+    }
+    
+    // the response times measured at the previous rate don't apply anymore
+    clearCommandStats();
+}
+
+uint32_t Sodaq_RN2483Bootloader::negotiateBaudRate(const uint32_t* baudRates, size_t count)
+{
+    debugPrintLn("[negotiateBaudRate]");
+    
+    if (sessionBaudRate != 0) {
+        switchBaudRate(sessionBaudRate);
+        
+        return sessionBaudRate;
+    }
+    
+    uint32_t bestBaudRate = getDefaultBootloaderBaudRate();
+    BootloaderVersionInfo referenceInfo;
+    BootloaderVersionInfo versionInfo;
+    
+    if (!getVersionInfo(referenceInfo)) {
+        debugPrintLn("The bootloader does not respond at the default baud rate!");
+        
+        return bestBaudRate;
+    }
+    
+    for (size_t i = 0; i < count; i++) {
+        if (baudRates[i] <= bestBaudRate) {
+            continue;
+        }
+        
+        switchBaudRate(baudRates[i]);
+        
+        // garbage can still make up a response, so it has to match what was received at the working rate
+        if (getVersionInfo(versionInfo) && (memcmp(&versionInfo, &referenceInfo, sizeof(versionInfo)) == 0)) {
+            bestBaudRate = baudRates[i];
+        }
+        else {
+            debugPrintLn("No valid response, falling back.");
+            
+            switchBaudRate(bestBaudRate);
+            
+            // the failed probe can have left the bootloader in a partial frame, so the rate is only kept
+            // once the bootloader responds at it again, with the same info
+            if (!resynchronize(RN2483_BOOTLOADER_FALLBACK_IDLE_TIME) || !getVersionInfo(versionInfo)
+                    || (memcmp(&versionInfo, &referenceInfo, sizeof(versionInfo)) != 0)) {
+                debugPrintLn("No valid response after falling back, using the default baud rate.");
+                
+                bestBaudRate = getDefaultBootloaderBaudRate();
+                switchBaudRate(bestBaudRate);
+            }
+            
+            break;
+        }
+    }
+    
+    sessionBaudRate = bestBaudRate;
+    
+    return sessionBaudRate;
+}
+
+void Sodaq_RN2483Bootloader::resetSessionBaudRate()
+{
+    sessionBaudRate = 0;
+    
+    switchBaudRate(getDefaultBootloaderBaudRate());
+}
+
+bool Sodaq_RN2483Bootloader::resynchronize(uint32_t idleMS)
+{
+    debugPrintLn("[resynchronize]");
+    
+    uint32_t startMS = millis();
+    uint32_t lastByteMS = startMS;
+    
+    // a line that never goes idle (e.g. at the wrong baud rate) is given up on eventually
+    while ((millis() - lastByteMS < idleMS) && (millis() - startMS < RN2483_BOOTLOADER_MAX_RESPONSE_TIMEOUT)) {
+        sodaq_wdt_reset();
+        
+        if (this->loraStream->available() > 0) {
+            this->loraStream->read();
+            lastByteMS = millis();
+        }
+        else {
+            yield();
+        }
+    }
+    
+    BootloaderVersionInfo versionInfo;
+    
+    return getVersionInfo(versionInfo);
 }
 
 void Sodaq_RN2483Bootloader::eraseFirmware()
@@ -53,12 +168,23 @@ bool Sodaq_RN2483Bootloader::getVersionInfo(BootloaderVersionInfo& versionInfo)
 
 bool Sodaq_RN2483Bootloader::writeFlash(uint32_t startingAddress, const uint8_t* buffer, size_t size)
 {
-    sendCommand(WriteFlashCommand, size, startingAddress);
-    
-    for (size_t i = 0; i < size; i++) {
-        loraStream->write((uint8_t)buffer[i]);
+    return beginWriteFlash(startingAddress, buffer, size) && finishWriteFlash();
+}
+
+bool Sodaq_RN2483Bootloader::beginWriteFlash(uint32_t startingAddress, const uint8_t* buffer, size_t size)
+{
+    if (size > RN2483_BOOTLOADER_MAX_COMMAND_LENGTH) {
+        debugPrintLn("The data does not fit in a single command!");
+        return false;
     }
     
+    sendCommand(WriteFlashCommand, size, startingAddress, buffer, size);
+    
+    return true;
+}
+
+bool Sodaq_RN2483Bootloader::finishWriteFlash()
+{
     BootloaderRecord response;
     
     if (readBootloaderResponse(response, (uint8_t*)inputBuffer, inputBufferSize) > 0) {
@@ -68,7 +194,6 @@ bool Sodaq_RN2483Bootloader::writeFlash(uint32_t startingAddress, const uint8_t*
     }
     
     return false;
-    
 }
 
 bool Sodaq_RN2483Bootloader::eraseFlash(uint32_t address, uint8_t blockCount)
@@ -85,10 +210,101 @@ bool Sodaq_RN2483Bootloader::eraseFlash(uint32_t address, uint8_t blockCount)
     return false;
 }
 
-void Sodaq_RN2483Bootloader::getChecksum()
+bool Sodaq_RN2483Bootloader::getChecksum(uint32_t address, uint16_t length, uint16_t& checksum)
+{
+    sendCommand(CalculateChecksumCommand, length, address);
+    BootloaderRecord response;
+    
+    if (readBootloaderResponse(response, (uint8_t*)inputBuffer, inputBufferSize) == 2) {
+        checksum = BYTES_TO_UINT16(inputBuffer[0], inputBuffer[1]);
+        
+        return true;
+    }
+    
+    return false;
+}
+
+bool Sodaq_RN2483Bootloader::readFlash(uint32_t address, uint8_t length, uint8_t* buffer)
+{
+    sendCommand(ReadFlashCommand, length, address);
+    BootloaderRecord response;
+    
+    return readBootloaderResponse(response, buffer, length) == length;
+}
+
+uint16_t Sodaq_RN2483Bootloader::calculateChecksum(const uint8_t* buffer, size_t size, uint16_t checksum)
 {
-    // TODO
-    // sendCommand(CalculateChecksumCommand, Length (from address), Address)
+    for (size_t i = 0; i + 1 < size; i += 2) {
+        checksum += BYTES_TO_UINT16(buffer[i], buffer[i + 1]);
+    }
+    
+    return checksum;
+}
+
+size_t Sodaq_RN2483Bootloader::encodeCommand(uint8_t* frame, uint8_t command, uint16_t length, uint32_t address)
+{
+    frame[0] = 0x55; // autobaud
+    frame[1] = command;
+    frame[2] = (uint8_t)length; // length (LSB)
+    frame[3] = (uint8_t)(length >> 8); // length (MSB)
+    frame[4] = 0x55; // Key1
+    frame[5] = 0xAA; // Key2
+    frame[6] = (uint8_t)address; // address part 0 (LSB side)
+    frame[7] = (uint8_t)(address >> 8);
+    frame[8] = (uint8_t)(address >> 16);
+    frame[9] = (uint8_t)(address >> 24); // address part 3 (MSB side)
+    
+    return sizeof(BootloaderRecord);
+}
+
+size_t Sodaq_RN2483Bootloader::getMaxWriteSize(const BootloaderVersionInfo& versionInfo, size_t bufferSize)
+{
+    size_t writeLatchSize = versionInfo.WriteLatchSize;
+    
+    if (writeLatchSize == 0) {
+        return 0;
+    }
+    
+    // a row is all a write is known to be accepted with, unless the device reports more
+    size_t maxSize = versionInfo.EraseRowSize;
+    
+    if (versionInfo.MaxPacketSize >= sizeof(BootloaderRecord) + writeLatchSize) {
+        maxSize = versionInfo.MaxPacketSize - sizeof(BootloaderRecord);
+    }
+    
+    maxSize = min(maxSize, bufferSize);
+    
+    return maxSize - (maxSize % writeLatchSize);
+}
+
+uint16_t Sodaq_RN2483Bootloader::getResponseDataLength(uint8_t command, uint16_t length)
+{
+    switch (command) {
+        case ReadFlashCommand :
+        case ReadEeCommand :
+        case ReadConfigurationWordsCommand :
+            return length;
+            
+        case WriteFlashCommand :
+        case EraseFlashCommand :
+        case WriteEeCommand :
+        case WriteConfigurationWordsCommand :
+            return 1; // the status
+            
+        // the checksum is returned as 2 bytes (LSB first), there is no status byte
+        case CalculateChecksumCommand :
+            return 2;
+            
+        // GetVersionInfoCommand does not send the length of the response as per documentation,
+        // but the version info always has the same size
+        case GetVersionInfoCommand :
+            return RN2483_BOOTLOADER_VERSION_INFO_SIZE;
+            
+        // the device resets without responding
+        case ResetDeviceCommand :
+        default :
+            return 0;
+    }
 }
 
 inline void printToLength(Stream& stream, const uint8_t* buffer, size_t length)
@@ -123,7 +339,8 @@ void Sodaq_RN2483Bootloader::bootloaderReset()
 {
     debugPrintLn("[bootloaderReset]");
     sendCommand(ResetDeviceCommand);
-    // no response
+    // no response, so make sure the command is out before anything else happens
+    this->loraStream->flush();
 }
 
 uint16_t Sodaq_RN2483Bootloader::readApplicationLn()
@@ -176,31 +393,237 @@ bool Sodaq_RN2483Bootloader::applicationReset(char* deviceResponseBuffer, size_t
 
     if (expectApplicationString("RN")) {
         debugPrintLn("[RN Module]");
-        if ((strstr(this->inputBuffer, "RN2483") != NULL) || (strstr(this->inputBuffer, "RN2903") != NULL)) {
-            if (deviceResponseBuffer && (size > strlen(this->inputBuffer))) {
-                debugPrintLn("Copying the response to the given buffer.");
-                memcpy(deviceResponseBuffer, this->inputBuffer, min(size, inputBufferSize));
-                deviceResponseBuffer[min(size, inputBufferSize)] = '\0'; // make sure the string is terminated
-            }
+        
+        return acceptApplicationBanner(deviceResponseBuffer, size);
+    }
+    
+    return false;
+}
 
-            return true;
+bool Sodaq_RN2483Bootloader::acceptApplicationBanner(char* deviceResponseBuffer, size_t size)
+{
+    if ((strstr(this->inputBuffer, "RN2483") == NULL) && (strstr(this->inputBuffer, "RN2903") == NULL)) {
+        debugPrintLn("Unknown device type!");
+        
+        return false;
+    }
+    
+    if (deviceResponseBuffer && (size > strlen(this->inputBuffer))) {
+        debugPrintLn("Copying the response to the given buffer.");
+        memcpy(deviceResponseBuffer, this->inputBuffer, strlen(this->inputBuffer) + 1);
+    }
+    
+    return true;
+}
+
+ModuleMode Sodaq_RN2483Bootloader::detectMode(char* deviceResponseBuffer, size_t size)
+{
+    debugPrintLn("[detectMode]");
+    
+    // also switches to the default bootloader baud rate
+    resetSessionBaudRate();
+    
+    // the application doesn't autobaud, so it doesn't take the frame for a command
+    sendCommand(GetVersionInfoCommand);
+    
+    BootloaderRecord response;
+    
+    // a probe without a response is not a failure of the command, so it is left out of the stats
+    bool isBootloaderResponding = readBootloaderFrame(response, (uint8_t*)inputBuffer, inputBufferSize,
+                                                      RN2483_BOOTLOADER_PROBE_TIMEOUT) > 0;
+    
+    if (isBootloaderResponding) {
+        debugPrintLn("The module is in bootloader mode.");
+        
+        return ModuleInBootloaderMode;
+    }
+    
+    switchBaudRate(getDefaultApplicationBaudRate());
+    
+    // the leading line ending terminates anything the application may have received before,
+    // the response to that (e.g. "invalid_param") is skipped along with any other line
+    this->loraStream->print("\r\nsys reset\r\n");
+    
+    uint32_t startMS = millis();
+    ModuleMode mode = ModuleNotResponding;
+    
+    while ((mode == ModuleNotResponding) && (millis() - startMS < RN2483_APPLICATION_PROBE_TIMEOUT)) {
+        this->loraStream->setTimeout(RN2483_APPLICATION_PROBE_TIMEOUT - (millis() - startMS));
+        
+        if (readApplicationLn() == 0) {
+            break;
         }
-        else {
-            debugPrintLn("Unknown device type!");
+        
+        debugPrintLn(this->inputBuffer);
+        
+        if ((strstr(this->inputBuffer, "RN") != NULL) && acceptApplicationBanner(deviceResponseBuffer, size)) {
+            mode = ModuleInApplicationMode;
+        }
+    }
+    
+    this->loraStream->setTimeout(RN2483_BOOTLOADER_INITIAL_RESPONSE_TIMEOUT);
+    
+    return mode;
+}
+
+bool Sodaq_RN2483Bootloader::isModuleResponding(ModuleMode mode)
+{
+    debugPrintLn("[isModuleResponding]");
+    
+    bool isResponding = false;
+    
+    if (mode == ModuleInBootloaderMode) {
+        sendCommand(GetVersionInfoCommand);
+        
+        BootloaderRecord response;
+        
+        // as with detectMode(), a probe is left out of the stats
+        isResponding = readBootloaderFrame(response, (uint8_t*)inputBuffer, inputBufferSize,
+                                           RN2483_BOOTLOADER_PROBE_TIMEOUT) > 0;
+    }
+    else if (mode == ModuleInApplicationMode) {
+        switchBaudRate(getDefaultApplicationBaudRate());
+        
+        // the leading line ending terminates anything the application may have received before
+        this->loraStream->print("\r\nsys get ver\r\n");
+        
+        uint32_t startMS = millis();
+        
+        while (!isResponding && (millis() - startMS < RN2483_APPLICATION_VERSION_TIMEOUT)) {
+            this->loraStream->setTimeout(RN2483_APPLICATION_VERSION_TIMEOUT - (millis() - startMS));
             
-            return false;
+            if (readApplicationLn() == 0) {
+                break;
+            }
+            
+            isResponding = (strstr(this->inputBuffer, "RN") != NULL);
         }
     }
     
-    return false;
+    this->loraStream->setTimeout(RN2483_BOOTLOADER_INITIAL_RESPONSE_TIMEOUT);
+    
+    return isResponding;
+}
+
+void Sodaq_RN2483Bootloader::clearCommandStats()
+{
+    memset(commandStats, 0, sizeof(commandStats));
 }
 
-// returns -2 in case of error, -1 if no response at all, 0 if only mainResponse, or the lenth of the secondary response otherwise
+// the part of the response time that grows with the command: the erase of each row,
+// or the transfer and processing of each byte, anything else counts as a single unit
+uint16_t Sodaq_RN2483Bootloader::getCommandUnits(uint8_t command, uint16_t length)
+{
+    switch (command) {
+        case EraseFlashCommand :
+        case ReadFlashCommand :
+        case WriteFlashCommand :
+        case ReadEeCommand :
+        case WriteEeCommand :
+        case ReadConfigurationWordsCommand :
+        case WriteConfigurationWordsCommand :
+        case CalculateChecksumCommand :
+            return max(length, (uint16_t)1);
+            
+        default :
+            return 1;
+    }
+}
+
+uint32_t Sodaq_RN2483Bootloader::getResponseTimeout(uint8_t command, uint16_t length)
+{
+    const BootloaderCommandStats& stats = getCommandStats(command);
+    
+    if (!isAdaptingTimeouts || (stats.ResponseCount == 0)) {
+        return RN2483_BOOTLOADER_INITIAL_RESPONSE_TIMEOUT;
+    }
+    
+    uint64_t timeoutMicros = (uint64_t)getCommandUnits(command, length) * (stats.SmoothedMicros + 4 * (uint64_t)stats.VariationMicros);
+    uint64_t timeoutMS = (timeoutMicros + 999) / 1000;
+    
+    return (uint32_t)min(max(timeoutMS, (uint64_t)RN2483_BOOTLOADER_MIN_RESPONSE_TIMEOUT), (uint64_t)RN2483_BOOTLOADER_MAX_RESPONSE_TIMEOUT);
+}
+
+// as for the TCP retransmission timer (RFC 6298), with the response time per unit of the command
+void Sodaq_RN2483Bootloader::updateCommandStats(bool isComplete)
+{
+    BootloaderCommandStats& stats = commandStats[lastCommand % RN2483_BOOTLOADER_COMMAND_COUNT];
+    
+    if (!isComplete) {
+        // back off, the response may simply take longer than measured so far
+        stats.FailureCount++;
+        stats.SmoothedMicros = min(stats.SmoothedMicros * 2, (uint32_t)RN2483_BOOTLOADER_MAX_RESPONSE_TIMEOUT * 1000);
+        
+        return;
+    }
+    
+    uint32_t sample = lastResponseMicros / getCommandUnits(lastCommand, lastCommandLength);
+    
+    if (stats.ResponseCount == 0) {
+        stats.SmoothedMicros = sample;
+        stats.VariationMicros = sample / 2;
+    }
+    else {
+        uint32_t difference = (sample > stats.SmoothedMicros) ? sample - stats.SmoothedMicros : stats.SmoothedMicros - sample;
+        
+        stats.VariationMicros = (3 * stats.VariationMicros + difference) / 4;
+        stats.SmoothedMicros = (7 * stats.SmoothedMicros + sample) / 8;
+    }
+    
+    stats.ResponseCount++;
+    stats.MaxResponseMicros = max(stats.MaxResponseMicros, lastResponseMicros);
+}
+
+// reads the response to the last command with the timeout of that command
 int16_t Sodaq_RN2483Bootloader::readBootloaderResponse(BootloaderRecord& mainResponse, uint8_t* secondaryResponse, uint8_t secondaryResponseSize)
+{
+    uint16_t frameLength = sizeof(mainResponse) + getResponseDataLength(lastCommand, lastCommandLength);
+    
+    // a response that was already complete before it is read (e.g. that of a pipelined WriteFlash, which is only
+    // collected once the next chunk has been parsed) arrived at an unknown time, so it is no sample of the response time
+    bool isTimed = this->loraStream->available() < frameLength;
+    
+    int16_t result = readBootloaderFrame(mainResponse, secondaryResponse, secondaryResponseSize,
+                                         getResponseTimeout(lastCommand, lastCommandLength));
+    
+    if ((result < 0) || isTimed) {
+        updateCommandStats(result >= 0);
+    }
+    
+    return result;
+}
+
+// reads the given number of bytes until the timeout has passed since the last command was sent: a deadline for
+// the whole response, unlike the timeout of Stream::readBytes(), which starts again for every byte
+size_t Sodaq_RN2483Bootloader::readResponseBytes(uint8_t* buffer, size_t length, uint32_t timeoutMS)
+{
+    size_t count = 0;
+    
+    while (count < length) {
+        int c = this->loraStream->read();
+        
+        if (c >= 0) {
+            buffer[count++] = (uint8_t)c;
+        }
+        else if (micros() - lastCommandMicros < timeoutMS * 1000) {
+            yield();
+        }
+        else {
+            break;
+        }
+    }
+    
+    return count;
+}
+
+// returns -2 in case of error (including a response that is not complete), -1 if no response at all,
+// 0 if only mainResponse, or the length of the secondary response otherwise
+int16_t Sodaq_RN2483Bootloader::readBootloaderFrame(BootloaderRecord& mainResponse, uint8_t* secondaryResponse, uint8_t secondaryResponseSize,
+                                                    uint32_t timeoutMS)
 {
     debugPrintLn("[readBootloaderResponse]");
     
-    int len = this->loraStream->readBytes((uint8_t*)&mainResponse, sizeof(mainResponse));
+    int len = readResponseBytes((uint8_t*)&mainResponse, sizeof(mainResponse), timeoutMS);
     
     #ifdef DEBUG_SYMBOLS_ON
     
@@ -215,45 +638,21 @@ int16_t Sodaq_RN2483Bootloader::readBootloaderResponse(BootloaderRecord& mainRes
         return -1;
     }
 
-    uint8_t expectLen = 0;
-
-    switch (mainResponse.Command) {
-      case ReadFlashCommand :
-      case ReadEeCommand :
-      case ReadConfigurationWordsCommand :
-        expectLen = mainResponse.Length;
-        break;
-            
-      case WriteFlashCommand :
-      case EraseFlashCommand :
-      case WriteEeCommand :
-      case WriteConfigurationWordsCommand :
-        expectLen = 1;
-        break;
-
-      // Documentation is unclear, it shows a 2 byte checksum in the
-      // repsonse, but also mentions a 'status'?
-      case CalculateChecksumCommand :
-        expectLen = 3; 
-        break;
-
-      // These will read until a time out.
-      // GetVersionInfoCommand does not send the length of the 
-      // response as per documentation.
-      case GetVersionInfoCommand : 
-      case ResetDeviceCommand :
-        expectLen = secondaryResponseSize;
-        break;
-    }
- 
+    if ((len != sizeof(mainResponse)) || (mainResponse.Command != lastCommand)) {
+        debugPrintLn("The response header does not match the command!");
+        return -2;
+    }
+    
+    // the length of every response is known, so it is read without waiting for a timeout
+    uint16_t expectLen = getResponseDataLength(lastCommand, lastCommandLength);
+    
     if (expectLen > secondaryResponseSize) {
         debugPrintLn("The secondary response cannot fit in the buffer!");
-        this->loraStream->flush();
         
         return -2;
     }
-
-    len = this->loraStream->readBytes(secondaryResponse, expectLen);
+    
+    len = readResponseBytes(secondaryResponse, expectLen, timeoutMS);
     
     #ifdef DEBUG_SYMBOLS_ON
     
@@ -263,22 +662,44 @@ int16_t Sodaq_RN2483Bootloader::readBootloaderResponse(BootloaderRecord& mainRes
     
     #endif
     
+    if (len != expectLen) {
+        debugPrintLn("The secondary response is incomplete!");
+        return -2;
+    }
+    
+    lastResponseMicros = micros() - lastCommandMicros;
+    
+    debugPrint("Response complete after ");
+    debugPrint(lastResponseMicros);
+    debugPrintLn(" us");
+    
     return len;
 }
 
-void Sodaq_RN2483Bootloader::sendCommand(uint8_t command, uint8_t length, uint32_t address)
+// the response is read right after, so there is no need to flush (and wait for the frame to go out)
+void Sodaq_RN2483Bootloader::sendCommand(uint8_t command, uint16_t length, uint32_t address, const uint8_t* data, size_t dataSize)
 {
-    this->loraStream->write((uint8_t)0x55); // autobaud
+    // anything still pending (e.g. the response to a command of a previous session) can't be part of this response
+    while (this->loraStream->available() > 0) {
+        this->loraStream->read();
+    }
     
-    this->loraStream->write((uint8_t)command); // command
-    this->loraStream->write((uint8_t)length); // length
-    this->loraStream->write((uint8_t)0x00); // unused part of length
-    this->loraStream->write((uint8_t)0x55); // Key1 = 0x55
-    this->loraStream->write((uint8_t)0xAA); // Key2 = 0xAA
-    this->loraStream->write((uint8_t)address); // address part 0 (LSB side)
-    this->loraStream->write((uint8_t)(address >> 8)); // address part 1
-    this->loraStream->write((uint8_t)(address >> 16)); // address part 2
-    this->loraStream->write((uint8_t)(address >> 24));  // address part 3 (MSB Side)
+    size_t frameLength = encodeCommand(frameBuffer, command, length, address);
     
-    this->loraStream->flush();
+    lastCommand = command;
+    lastCommandLength = length;
+    lastCommandMicros = micros();
+    lastResponseMicros = 0;
+    
+    if ((dataSize > 0) && (dataSize <= sizeof(frameBuffer) - frameLength)) {
+        memcpy(&frameBuffer[frameLength], data, dataSize);
+        frameLength += dataSize;
+        dataSize = 0;
+    }
+    
+    this->loraStream->write(frameBuffer, frameLength);
+    
+    if (dataSize > 0) {
+        this->loraStream->write(data, dataSize);
+    }
 }
@@ -9,12 +9,29 @@
 
 #define RN2483_BOOTLOADER_INPUT_BUFFER_SIZE 128
 #define RN2483_BOOTLOADER_DEFAULT_TIMEOUT 120
+#define RN2483_BOOTLOADER_MAX_COMMAND_LENGTH 0xFFFF // the length of a command is sent as 16 bits
+#define RN2483_BOOTLOADER_PROGRAM_MEMORY_END 0x200000 // the user ID and configuration words follow the program memory
+#define RN2483_BOOTLOADER_VERSION_INFO_SIZE 16 // see BootloaderVersionInfo
+#define RN2483_BOOTLOADER_MAX_FRAME_DATA 256 // larger data is sent in a second write, after the frame header
+
+// response timeouts (ms): the stream default until a command type has been measured,
+// the measured ones are clamped, so that neither a lost byte nor a slow erase costs too much
+#define RN2483_BOOTLOADER_INITIAL_RESPONSE_TIMEOUT 1000
+#define RN2483_BOOTLOADER_MIN_RESPONSE_TIMEOUT 50
+#define RN2483_BOOTLOADER_MAX_RESPONSE_TIMEOUT 3000
+#define RN2483_BOOTLOADER_COMMAND_COUNT 10 // see Command
+#define RN2483_BOOTLOADER_FALLBACK_IDLE_TIME 100 // ms, see negotiateBaudRate()
+
+// the timeouts (ms) of detecting the mode of the module: the response to GetVersionInfo only takes a
+// few ms, the banner of the application only follows once it has restarted after "sys reset"
+#define RN2483_BOOTLOADER_PROBE_TIMEOUT 50
+#define RN2483_APPLICATION_PROBE_TIMEOUT 500
+#define RN2483_APPLICATION_VERSION_TIMEOUT 100 // "sys get ver" is answered right away, see isModuleResponding()
 
 struct BootloaderRecord {
     uint8_t AutoBaudChar;
     uint8_t Command;
-    uint8_t Length;
-    uint8_t Dummy1;
+    uint16_t Length;
     uint8_t Key1;
     uint8_t Key2;
     
@@ -37,14 +54,31 @@ enum Command {
     ResetDeviceCommand = 0x09
 };
 
+// the response times of a command type, the smoothed time and its variation are per unit of
+// the command (an erased row or a byte of data, see getCommandUnits()) and drive the timeout
+struct BootloaderCommandStats {
+    uint32_t ResponseCount; // that were timed, a response that was already complete when it was read is not
+    uint32_t FailureCount; // no complete (or no matching) response in time
+    uint32_t SmoothedMicros;
+    uint32_t VariationMicros;
+    uint32_t MaxResponseMicros; // of a whole command
+};
+
+enum ModuleMode {
+    ModuleNotResponding,
+    ModuleInBootloaderMode,
+    ModuleInApplicationMode
+};
+
 struct BootloaderVersionInfo {
     union {
         uint16_t BootloaderVersion;
         uint8_t BootloaderVersionLowByte;
         uint8_t BootloaderVersionHighByte;
     };
-    uint8_t Reserved1;
-    uint8_t Reserved2;
+    // the maximum packet size (command header included), as reported by the bootloaders that
+    // implement it, only to be trusted when it can hold at least a header and a write latch
+    uint16_t MaxPacketSize;
     uint8_t Reserved3;
     uint8_t Reserved4;
     union {
@@ -73,6 +107,23 @@ class Sodaq_RN2483Bootloader
         
         void initBootloader(Uart& stream);
         
+        // Tries the given (ascending) baud rates above the default bootloader baud rate, relying on the
+        // autobaud character of each frame, and keeps the highest one for which GetVersionInfo returns
+        // the same info as at the current rate. Falls back to the last working rate on the first failure,
+        // once it has been verified again after a resynchronize(), or else to the default bootloader baud rate.
+        // The result is remembered for the session, so later calls switch to it without probing again.
+        uint32_t negotiateBaudRate(const uint32_t* baudRates, size_t count);
+        
+        uint32_t getSessionBaudRate() { return sessionBaudRate; };
+        
+        // forgets the negotiated baud rate and switches back to the default bootloader baud rate
+        void resetSessionBaudRate();
+        
+        // recovers from a lost or garbled frame: drops anything received until the line has been idle
+        // for the given time (by then the bootloader has also given up on a partial frame), and then
+        // checks that the bootloader responds again (the autobaud character of the frame re-syncs it)
+        bool resynchronize(uint32_t idleMS);
+        
         void setDiag(Stream& stream) { diagStream = &stream; };
         
         void eraseFirmware();
@@ -81,31 +132,107 @@ class Sodaq_RN2483Bootloader
         
         bool writeFlash(uint32_t startingAddress, const uint8_t* buffer, size_t size);
         
+        // WriteFlash in two phases: the command and its data are sent without waiting for the response,
+        // which has to be collected with finishWriteFlash() before the next command is sent (a response that
+        // has already arrived by then is not counted in the response times, as it is unknown when it did)
+        bool beginWriteFlash(uint32_t startingAddress, const uint8_t* buffer, size_t size);
+        bool finishWriteFlash();
+        
         bool eraseFlash(uint32_t address, uint8_t blockCount);
         
-        void getChecksum();
+        // the checksum calculated by the bootloader over the given (even) number of bytes of program memory
+        bool getChecksum(uint32_t address, uint16_t length, uint16_t& checksum);
+        
+        // reads the given number of bytes of program memory, which has to fit a packet of the bootloader
+        bool readFlash(uint32_t address, uint8_t length, uint8_t* buffer);
+        
+        // the same checksum as calculated by the bootloader: the sum of the little endian 16 bit words
+        // of the (even sized) buffer, added to the given checksum so that it can be calculated in parts
+        static uint16_t calculateChecksum(const uint8_t* buffer, size_t size, uint16_t checksum = 0);
+        
+        // framing, for clients that drive the serial port themselves (e.g. without blocking):
+        // the header of a command, which is followed by its data (if any), returns the header size
+        static size_t encodeCommand(uint8_t* frame, uint8_t command, uint16_t length = 0, uint32_t address = 0);
+        
+        // the number of bytes that follow the echoed header in the response to a command,
+        // given the length field of the command
+        static uint16_t getResponseDataLength(uint8_t command, uint16_t length);
+        
+        // the largest data size of a WriteFlash command, in whole write latches and at most bufferSize: bounded by the
+        // maximum packet size the device reports, or a single erase row if it doesn't report one (0 without a write latch)
+        static size_t getMaxWriteSize(const BootloaderVersionInfo& versionInfo, size_t bufferSize);
         
         void bootloaderReset();
         
         bool applicationReset(char* deviceResponseBuffer, size_t size);
 
         bool applicationReset() { return applicationReset(0, 0); };
+        
+        // probes the module in both modes, each at its default baud rate and with a short timeout: a GetVersionInfo
+        // frame first, then "sys reset" (the banner of the application is copied to the given buffer); the stream is
+        // left at the baud rate of the detected mode, and a negotiated baud rate is forgotten (it may be another module)
+        ModuleMode detectMode(char* deviceResponseBuffer, size_t size);
+        
+        // checks whether a module responds in the given mode, without resetting it (e.g. to notice that it has been
+        // inserted or removed): GetVersionInfo in bootloader mode, at the current baud rate (the bootloader autobauds),
+        // or "sys get ver" in application mode, at the default application baud rate
+        bool isModuleResponding(ModuleMode mode);
+        
+        // the time from sending the last command until its response was read completely (0 if there was none),
+        // which is later than it arrived if it was only read afterwards (see finishWriteFlash())
+        uint32_t getLastResponseMicros() { return lastResponseMicros; };
+        
+        // the response timeout of each command is derived from its measured response times (the smoothed
+        // time plus four times its variation, as for TCP), instead of using the same timeout for all
+        void setAdaptiveTimeouts(bool isAdaptive) { isAdaptingTimeouts = isAdaptive; };
+        uint32_t getResponseTimeout(uint8_t command, uint16_t length);
+        
+        const BootloaderCommandStats& getCommandStats(uint8_t command) { return commandStats[command % RN2483_BOOTLOADER_COMMAND_COUNT]; };
+        void clearCommandStats();
     private:
         Uart* loraStream;
         
         Stream* diagStream;
         
+        uint32_t sessionBaudRate;
+        
+        // the last command sent, its response is read as a frame of known length
+        uint8_t lastCommand;
+        uint16_t lastCommandLength;
+        uint32_t lastCommandMicros;
+        uint32_t lastResponseMicros;
+        
+        bool isAdaptingTimeouts;
+        BootloaderCommandStats commandStats[RN2483_BOOTLOADER_COMMAND_COUNT];
+        
         uint16_t inputBufferSize;
         
         char inputBuffer[RN2483_BOOTLOADER_INPUT_BUFFER_SIZE];
         
+        // a command is assembled here with its data, so that it is handed to the UART in a single write
+        uint8_t frameBuffer[sizeof(BootloaderRecord) + RN2483_BOOTLOADER_MAX_FRAME_DATA];
+        
+        void switchBaudRate(uint32_t baudRate);
+        
         uint16_t readApplicationLn();
         
         bool expectApplicationString(const char* str, uint16_t timeout = RN2483_BOOTLOADER_DEFAULT_TIMEOUT);
         
+        // checks that the line in the input buffer is the banner of a supported module, and copies it to the given buffer
+        bool acceptApplicationBanner(char* deviceResponseBuffer, size_t size);
+        
         int16_t readBootloaderResponse(BootloaderRecord& mainResponse, uint8_t* secondaryResponse, uint8_t secondaryResponseSize);
         
-        void sendCommand(uint8_t command, uint8_t length = 0, uint32_t address = 0);
+        int16_t readBootloaderFrame(BootloaderRecord& mainResponse, uint8_t* secondaryResponse, uint8_t secondaryResponseSize,
+                                    uint32_t timeoutMS);
+        
+        size_t readResponseBytes(uint8_t* buffer, size_t length, uint32_t timeoutMS);
+        
+        static uint16_t getCommandUnits(uint8_t command, uint16_t length);
+        
+        void updateCommandStats(bool isComplete);
+        
+        void sendCommand(uint8_t command, uint16_t length = 0, uint32_t address = 0, const uint8_t* data = 0, size_t dataSize = 0);
 };
 
 #endif
\ No newline at end of file
@@ -1,15 +1,19 @@
 #include "RN2483Bootloader.h"
 #include "IntelHexParser.h"
+#include "FlashProgrammer.h"
 #include "Utils.h"
 #include "Sodaq_wdt.h"
 
 #include "HexFileImage.h"
 
 // TODO ask user if should erase blocks
-// TODO investigate larger writing blocks for higher speed
 
 #define DEBUG_SYMBOLS_ON
 
+// Uncomment for headless operation on a production line (see updateNextModule()): no delays and no keys,
+// every module that is inserted is updated and verified, and a pass/fail record is printed for it
+//#define PRODUCTION_LINE_MODE
+
 #define CONSOLE_STREAM SERIAL_PORT_MONITOR
 #define DEBUG_STREAM SERIAL_PORT_MONITOR
 
@@ -17,6 +21,8 @@
 #define LORA_STREAM Serial2
 #elif defined(ARDUINO_SODAQ_AUTONOMO) || defined(ARDUINO_SODAQ_ONE) || defined(ARDUINO_SODAQ_ONE_BETA)
 #define LORA_STREAM Serial1
+#elif defined(ARDUINO_HOST)
+#define LORA_STREAM Serial1 // see extras/host
 #endif
 
 #ifdef DEBUG_SYMBOLS_ON
@@ -36,81 +42,367 @@
 
 #define HexFileImageName STR(HexFileImage)
 
+#if !defined(HexFileImageVersion)
+#define HexFileImageVersion "" // unknown, the module is always updated
+#endif
+
 const uint8_t VersionMajor = 1;
 const uint8_t VersionMinor = 4;
-const uint8_t PageSize = 64;
+const size_t MaxPageSize = 256; // the actual page size is the erase row size reported by the bootloader
+const uint32_t BootloaderBaudRates[] = { 57600, 115200, 230400 }; // tried in this order, above the default bootloader baud rate
+const bool ShouldUpdateIncrementally = true; // only erase and write the regions that the module doesn't already hold
+const uint32_t ModulePollInterval = 250; // ms between the probes for a module being inserted or removed
+const uint8_t ExpectedEraseRowSize = 64; // as reported by the RN2483/RN2903 bootloader, the plan is scanned ahead of time for it
+
+// the image is verified and its erase plan is scanned while the updater waits for the operator (see idle()),
+// one pass per step, so that the update can start as soon as the operator is ready
+enum ImagePreparation {
+    ImageUnverified,
+    ImageVerified,
+    ImagePlanned,
+    ImageInvalid
+};
+
+// the progress of an update, so that an interrupted one can be resumed (see FlashProgrammer::resumeFrom())
+struct UpdateCheckpoint {
+    uint32_t ImageHash; // of the image data and its plan, a checkpoint only applies to the same update
+    uint32_t CompletedRangeCount; // 0 for none
+};
 
 Sodaq_RN2483Bootloader bootloader;
-IntelHexParser hexParser(PageSize);
+StaticIntelHexParser<MaxPageSize> hexParser;
+FlashProgrammer programmer;
 
 bool isDebugOn = false;
-bool shouldEraseBlocks = true;
 int8_t lastHexParserProgressPercent = -1;
-bool shouldUseBootloaderMode = false;
+bool shouldUseBootloaderMode = false; // skips the detection of the mode of the module
+bool isModuleMissing = false; // reported once, until the module responds again
+bool isFirmwareErased = false; // the bootloader has just been started with sys eraseFW, which blanks the flash
+uint32_t moduleCount = 0; // on the production line
+uint32_t passedModuleCount = 0;
+ImagePreparation imagePreparation = ImageUnverified;
 
 bool onPageStart(uint32_t startingAddress);
 bool onPageComplete(uint32_t startingAddress, const uint8_t* buffer, size_t size);
+bool onPageScanned(uint32_t startingAddress, const uint8_t* buffer, size_t size);
 void onHexParserProgress(size_t currentLine, size_t totalLines);
+void onHexParserYield();
+void printCommandStats();
+void onCheckpoint(size_t completedRangeCount);
+uint32_t getImageHash();
+bool isImageInstalled(const char* applicationResponse);
+bool prepareImage();
+const char* updateFirmware(const BootloaderVersionInfo& versionInfo, bool isFlashErased, bool isResumable);
+void updateNextModule();
+void idle(uint32_t durationMS);
+void waitForModuleRemoval(ModuleMode mode);
+bool loadCheckpoint(UpdateCheckpoint& checkpoint);
+void saveCheckpoint(const UpdateCheckpoint& checkpoint);
 
 bool onPageStart(uint32_t startingAddress)
 {
-    if (shouldEraseBlocks) {
-        if (bootloader.eraseFlash(startingAddress, 1)) {
-            debugPrint("Successfully erased block starting at 0x");
-            debugPrintln(startingAddress, HEX);
-            
-            return true;
+    return programmer.startPage(startingAddress);
+}
+
+bool onPageComplete(uint32_t startingAddress, const uint8_t* buffer, size_t size)
+{
+    return programmer.completePage(startingAddress, buffer, size);
+}
+
+bool onPageScanned(uint32_t startingAddress, const uint8_t* buffer, size_t size)
+{
+    // a full plan just falls back to erasing per page, so keep scanning
+    programmer.planPage(startingAddress, buffer, size);
+    
+    return true;
+}
+
+void onHexParserProgress(size_t currentLine, size_t totalLines)
+{
+    const uint8_t progressBarStepPercent = 2; // 1 step every x% done
+    const uint8_t progressBarTextPercent = 25; // 1 text reference per x% done
+    
+    const int8_t percent = (currentLine * 100) / (totalLines - 1);
+    
+    if (currentLine == 0) {
+        lastHexParserProgressPercent = -1;
+    }
+    
+    // progress is only reported once per yield interval, so catch up on the skipped steps
+    while (lastHexParserProgressPercent < percent) {
+        lastHexParserProgressPercent++;
+        
+        if (lastHexParserProgressPercent % progressBarTextPercent == 0) {
+            consolePrint(" ");
+            consolePrint(lastHexParserProgressPercent);
+            consolePrint("% ")
         }
-        else {
-            debugPrint("Failed to erase block starting at 0x");
-            debugPrintln(startingAddress, HEX);
+        else if (lastHexParserProgressPercent % progressBarStepPercent == 0) {
+            consolePrint("|");
+        }
+        
+        if (lastHexParserProgressPercent == 100) {
+            consolePrintln();
+        }
+    }
+}
+
+void onHexParserYield()
+{
+    sodaq_wdt_reset();
+}
+
+// the banner of the application starts with the version of the image if the module already runs it
+bool isImageInstalled(const char* applicationResponse)
+{
+    size_t versionLength = strlen(HexFileImageVersion);
+    
+    return (versionLength > 0) && (strncmp(applicationResponse, HexFileImageVersion, versionLength) == 0);
+}
+
+// does the next step of preparing the image, returns false once there is nothing left to do
+bool prepareImage()
+{
+    if ((imagePreparation == ImagePlanned) || (imagePreparation == ImageInvalid)) {
+        return false;
+    }
+    
+    // the passes run in the background, so they don't report their progress
+    hexParser.setProgressCallback(0);
+    
+    if (imagePreparation == ImageUnverified) {
+        imagePreparation = hexParser.verifyImageIntegrity() ? ImageVerified : ImageInvalid;
+    }
+    else {
+        BootloaderVersionInfo expectedVersionInfo;
+        memset(&expectedVersionInfo, 0, sizeof(expectedVersionInfo));
+        expectedVersionInfo.EraseRowSize = ExpectedEraseRowSize;
+        expectedVersionInfo.WriteLatchSize = ExpectedEraseRowSize;
+        
+        // a plan that failed is simply scanned again once the module is in bootloader mode
+        if (programmer.configureGeometry(expectedVersionInfo)) {
+            programmer.beginErasePlan(ShouldUpdateIncrementally);
             
-            return false;
+            if (!hexParser.scanImage(onPageScanned)) {
+                programmer.beginErasePlan(ShouldUpdateIncrementally);
+            }
         }
+        
+        imagePreparation = ImagePlanned;
     }
     
+    hexParser.setProgressCallback(onHexParserProgress);
+    
     return true;
 }
 
-bool onPageComplete(uint32_t startingAddress, const uint8_t* buffer, size_t size)
+// waits for the given time, preparing the image meanwhile
+void idle(uint32_t durationMS)
+{
+    uint32_t startMS = millis();
+    
+    while ((millis() - startMS < durationMS) && prepareImage()) { }
+    
+    uint32_t elapsedMS = millis() - startMS;
+    
+    if (elapsedMS < durationMS) {
+        sodaq_wdt_safe_delay(durationMS - elapsedMS);
+    }
+}
+
+// waits until the module found in the given mode stops responding (it has been removed), without resetting it,
+// preparing the image meanwhile
+void waitForModuleRemoval(ModuleMode mode)
 {
-    if (bootloader.writeFlash(startingAddress, buffer, size)) {
-        debugPrint("Successfully wrote block starting at 0x");
-        debugPrintln(startingAddress, HEX);
+    while (bootloader.isModuleResponding(mode)) {
+        idle(ModulePollInterval);
+    }
+}
+
+void onCheckpoint(size_t completedRangeCount)
+{
+    UpdateCheckpoint checkpoint = { getImageHash(), (uint32_t)completedRangeCount };
+    
+    saveCheckpoint(checkpoint);
+}
+
+// FNV-1a over the ranges of the plan: their addresses and the checksums and digests of the image data in them
+uint32_t getImageHash()
+{
+    const ErasePlan& plan = programmer.getErasePlan();
+    uint32_t hash = ERASE_PLAN_DIGEST_BASIS;
+    
+    for (size_t i = 0; i < plan.getRangeCount(); i++) {
+        const EraseRange& range = plan.getRange(i);
         
-        return true;
+        hash = ErasePlan::updateDigest(hash, (const uint8_t*)&range.Address, sizeof(range.Address));
+        hash = ErasePlan::updateDigest(hash, &range.RowCount, sizeof(range.RowCount));
+        hash = ErasePlan::updateDigest(hash, (const uint8_t*)&range.Checksum, sizeof(range.Checksum));
+        hash = ErasePlan::updateDigest(hash, (const uint8_t*)&range.Digest, sizeof(range.Digest));
     }
-    else {
-        debugPrint("Failed to write block starting at 0x");
-        debugPrintln(startingAddress, HEX);
+    
+    return hash;
+}
+
+#if !defined(ARDUINO_HOST)
+
+// there is no non-volatile storage for the checkpoint on the boards, so it is only kept
+// as long as the sketch is running (the host build keeps it in a file, see extras/host)
+UpdateCheckpoint storedCheckpoint = { 0, 0 };
+
+bool loadCheckpoint(UpdateCheckpoint& checkpoint)
+{
+    checkpoint = storedCheckpoint;
+    
+    return true;
+}
+
+void saveCheckpoint(const UpdateCheckpoint& checkpoint)
+{
+    storedCheckpoint = checkpoint;
+}
+
+#endif
+
+// the response times the bootloader timeouts are derived from, per command type
+void printCommandStats()
+{
+    const char* commandNames[RN2483_BOOTLOADER_COMMAND_COUNT] = {
+        "GetVersionInfo", "ReadFlash", "WriteFlash", "EraseFlash", "ReadEe",
+        "WriteEe", "ReadConfig", "WriteConfig", "Checksum", "Reset"
+    };
+    
+    for (uint8_t command = 0; command < RN2483_BOOTLOADER_COMMAND_COUNT; command++) {
+        const BootloaderCommandStats& stats = bootloader.getCommandStats(command);
         
-        return false;
+        if ((stats.ResponseCount == 0) && (stats.FailureCount == 0)) {
+            continue;
+        }
+        
+        consolePrint(commandNames[command]);
+        consolePrint(": ");
+        consolePrint(stats.ResponseCount);
+        consolePrint(" response(s), ");
+        consolePrint(stats.FailureCount);
+        consolePrint(" failure(s), ");
+        consolePrint(stats.SmoothedMicros);
+        consolePrint(" +/- ");
+        consolePrint(stats.VariationMicros);
+        consolePrint(" us per unit, max ");
+        consolePrint(stats.MaxResponseMicros);
+        consolePrintln(" us");
     }
 }
 
-void onHexParserProgress(size_t currentLine, size_t totalLines)
+// the update of a module in bootloader mode, from its version info to the verification of the flash;
+// returns 0 on success, or what failed (the module is left as it is then)
+// only a module that was found in bootloader mode (not one that has just been erased) can hold part of the image
+const char* updateFirmware(const BootloaderVersionInfo& versionInfo, bool isFlashErased, bool isResumable)
 {
-    const uint8_t progressBarStepPercent = 2; // 1 step every x% done
-    const uint8_t progressBarTextPercent = 25; // 1 text reference per x% done
+    consolePrintln("\n* The module is in Bootloader mode.");
+    consolePrint("Bootloader Version: ");
+    consolePrintln(versionInfo.BootloaderVersion, HEX);
+    consolePrint("Device ID: ");
+    consolePrintln(versionInfo.DeviceId, HEX);
+    consolePrint("Erase Row Size: ");
+    consolePrintln(versionInfo.EraseRowSize);
+    consolePrint("Write Latch Size: ");
+    consolePrintln(versionInfo.WriteLatchSize);
+    consolePrint("Max Packet Size: ");
+    consolePrintln(versionInfo.MaxPacketSize);
+    
+    if (!programmer.configureGeometry(versionInfo)) {
+        return "The flash geometry reported by the bootloader is not supported.";
+    }
+    
+    consolePrint("Baud Rate: ");
+    consolePrintln(bootloader.negotiateBaudRate(BootloaderBaudRates, ARRAY_SIZE(BootloaderBaudRates)));
     
-    const uint8_t percent = (currentLine * 100) / (totalLines - 1);
+    consolePrintln("\n* Planning the flash erase...");
     
-    if (percent != lastHexParserProgressPercent) {
-        lastHexParserProgressPercent = percent;
+    // the plan scanned ahead of time only fits a module with the expected erase row size
+    if (!programmer.reuseErasePlan()) {
+        programmer.beginErasePlan(ShouldUpdateIncrementally);
         
-        if (percent % progressBarTextPercent == 0) {
-            consolePrint(" ");
-            consolePrint(percent);
-            consolePrint("% ")
+        if (!hexParser.scanImage(onPageScanned)) {
+            return "Failed to scan the firmware image.";
         }
-        else if (percent % progressBarStepPercent == 0) {
-            consolePrint("|");
+    }
+    
+    if (programmer.getErasePlan().isComplete()) {
+        UpdateCheckpoint checkpoint;
+        
+        // the regions up to the checkpoint are not compared again, the last one is only verified
+        if (!isFlashErased && isResumable && loadCheckpoint(checkpoint) && (checkpoint.ImageHash == getImageHash())
+                && programmer.resumeFrom(checkpoint.CompletedRangeCount)) {
+            consolePrint("Resuming the interrupted update after ");
+            consolePrint(checkpoint.CompletedRangeCount);
+            consolePrint(" of ");
+            consolePrint(programmer.getErasePlan().getRangeCount());
+            consolePrintln(" regions.");
         }
         
-        if (percent == 100) {
-            consolePrintln();
+        // on failure all the regions are simply updated
+        if (ShouldUpdateIncrementally && !isFlashErased && programmer.compareWithDevice()) {
+            consolePrint("Incremental update: ");
+            consolePrint(programmer.getErasePlan().getChangedRowCount());
+            consolePrint(" of ");
+            consolePrint(programmer.getErasePlan().getRowCount());
+            consolePrintln(" rows differ from the module.");
+        }
+        
+        if (!programmer.executeErasePlan()) {
+            return "Failed to erase the flash.";
         }
+        
+        consolePrint("Erased ");
+        consolePrint(programmer.getErasePlan().getChangedRowCount());
+        consolePrint(" rows with ");
+        consolePrint(programmer.getEraseCommandCount());
+        consolePrintln(" command(s).");
+    }
+    else {
+        consolePrintln("The erase plan does not fit, erasing per page instead.");
+    }
+    
+    consolePrintln("\n* Starting firmware update...");
+    
+    lastHexParserProgressPercent = -1;
+    
+    if (!hexParser.parseImageFrom(programmer.getStartPosition()) || !programmer.finishPages()) {
+        return "Failed to upload the firmware.";
+    }
+    
+    if (programmer.getErasePlan().isComplete()) {
+        consolePrintln("\n* Verifying the flash...");
+        
+        if (!programmer.verifyFlash()) {
+            return "Flash verification failed!";
+        }
+        
+        consolePrint("Flash verification successful (");
+        consolePrint(programmer.getChecksumCommandCount());
+        consolePrintln(" checksum commands).");
+    }
+    
+    // the next module starts from scratch
+    if (isResumable) {
+        UpdateCheckpoint checkpoint = { 0, 0 };
+        saveCheckpoint(checkpoint);
     }
+    
+    consolePrintln("Firmware update has finished successfully!");
+    
+    if (programmer.getRetryCount() > 0) {
+        consolePrint("Recovered by retrying ");
+        consolePrint(programmer.getRetryCount());
+        consolePrintln(" command(s).");
+    }
+    
+    consolePrintln("\nResponse times:");
+    printCommandStats();
+    
+    return 0;
 }
 
 void setup()
@@ -131,7 +423,21 @@ void setup()
     sodaq_wdt_safe_delay(100);
     #endif
 
-    sodaq_wdt_safe_delay(5000);
+    hexParser.setPageStartCallback(onPageStart);
+    hexParser.setPageCompleteCallback(onPageComplete);
+    hexParser.setProgressCallback(onHexParserProgress);
+    hexParser.setYieldCallback(onHexParserYield);
+    
+    programmer.init(bootloader, hexParser);
+    
+    // the modules on the production line are not resumed, so their progress is not stored
+    #if !defined(PRODUCTION_LINE_MODE)
+    programmer.setCheckpointCallback(onCheckpoint);
+    #endif
+    
+    #if !defined(PRODUCTION_LINE_MODE)
+    idle(5000);
+    #endif
     
     if (DEBUG_STREAM != CONSOLE_STREAM) {
         CONSOLE_STREAM.begin(115200);
@@ -143,8 +449,11 @@ void setup()
     consolePrint(".");
     consolePrintln(VersionMinor);
     
+    #if defined(PRODUCTION_LINE_MODE)
+    consolePrintln("Production line mode");
+    #else
     consolePrintln("\nPress:");
-    consolePrintln(" - \'b\' to enable bootloader mode");
+    consolePrintln(" - \'b\' to force bootloader mode (it is detected otherwise)");
     consolePrintln(" - \'d\' to enable debug");
     
     for (uint8_t i = 0; i < 5 * 4; i++) {
@@ -164,27 +473,27 @@ void setup()
             }
         }
         
-        sodaq_wdt_safe_delay(250);
+        idle(250);
         consolePrint(".");
     }
     
     consolePrintln();
+    #endif
     
     if (isDebugOn) {
         DEBUG_STREAM.begin(115200);
         
         bootloader.setDiag(DEBUG_STREAM);
         hexParser.setDiag(DEBUG_STREAM);
+        programmer.setDiag(DEBUG_STREAM);
     }
     
-    hexParser.setPageStartCallback(onPageStart);
-    hexParser.setPageCompleteCallback(onPageComplete);
-    hexParser.setProgressCallback(onHexParserProgress);
-    
     consolePrintln("\n* Starting HEX File Image Verification...");
     
-    // verify image first
-    if (hexParser.verifyImageIntegrity()) {
+    // normally the image has already been verified (and planned) while waiting
+    while (prepareImage()) { }
+    
+    if (imagePreparation != ImageInvalid) {
         consolePrintln("HEX File Image Verification Successful!");
     }
     else {
@@ -194,13 +503,56 @@ void setup()
         while (true) { }
     }
     
+    #if !defined(PRODUCTION_LINE_MODE)
+    UpdateCheckpoint checkpoint;
+    
+    // the plan that has been scanned ahead of time is that of the update the checkpoint was stored for
+    if (loadCheckpoint(checkpoint) && (checkpoint.CompletedRangeCount > 0) && programmer.getErasePlan().isComplete()
+            && (checkpoint.ImageHash == getImageHash())) {
+        consolePrint("An interrupted update of this image will be resumed after ");
+        consolePrint(checkpoint.CompletedRangeCount);
+        consolePrint(" of ");
+        consolePrint(programmer.getErasePlan().getRangeCount());
+        consolePrintln(" regions, if the module still holds them.");
+    }
+    #endif
+    
     bootloader.initBootloader(LORA_STREAM);
 }
 
 void loop()
 {
-    if (shouldUseBootloaderMode) {
+    #if defined(PRODUCTION_LINE_MODE)
+    updateNextModule();
+    #else
+    char applicationResetResponse[64];
+    ModuleMode mode = ModuleInBootloaderMode;
+    
+    if (!shouldUseBootloaderMode) {
+        #if defined(LORA_RESET)
+        digitalWrite(LORA_RESET, LOW);
+        sodaq_wdt_safe_delay(100);
+        digitalWrite(LORA_RESET, HIGH);
+        sodaq_wdt_safe_delay(1000);
+        #endif
+        
+        mode = bootloader.detectMode(applicationResetResponse, sizeof(applicationResetResponse));
+        
+        if (mode == ModuleNotResponding) {
+            if (!isModuleMissing) {
+                consolePrintln("\nThe module did not respond in either mode. Waiting for it to respond...");
+                isModuleMissing = true;
+            }
+            
+            return;
+        }
+        
+        isModuleMissing = false;
+    }
+    
+    if (mode == ModuleInBootloaderMode) {
         uint32_t startMS = millis();
+        bool isUpdateFinished = false;
         
         LORA_STREAM.begin(bootloader.getDefaultBootloaderBaudRate());
         sodaq_wdt_safe_delay(200);
@@ -208,66 +560,160 @@ void loop()
         BootloaderVersionInfo versionInfo;
         
         if (bootloader.getVersionInfo(versionInfo)) {
-            consolePrintln("\n* The module is in Bootloader mode.");
-            consolePrint("Bootloader Version: ");
-            consolePrintln(versionInfo.BootloaderVersion, HEX);
-            consolePrint("Device ID: ");
-            consolePrintln(versionInfo.DeviceId, HEX);
-            
-            consolePrintln("\n* Starting firmware update...");
+            const char* failure = updateFirmware(versionInfo, isFirmwareErased, true);
             
-            if (hexParser.parseImage()) {
-                consolePrintln("Firmware update has finished successfully! Please unplug the module to restart.");
-            }
-            else {
-                consolePrintln("Failed to upload the firmware. Please unplug and restart.");
+            if (failure) {
+                consolePrint(failure);
+                consolePrintln(" Please unplug and restart.");
                 
                 while (true) { }
             }
             
+            isUpdateFinished = true;
+            
             // consolePrintln("Resetting the module...");
             // bootloader.bootloaderReset();
             
             shouldUseBootloaderMode = false;
         }
         else {
-            consolePrintln("The module did not respond in bootloader mode. Please unplug and retry in application mode.");
+            consolePrintln("The module did not respond in bootloader mode. Detecting its mode again...");
+            
+            shouldUseBootloaderMode = false;
+            isFirmwareErased = false;
         }
 
-        consolePrintln("Elapsed Time: " + String((float)(millis() - startMS) / 1000) + "s");
+        consolePrint("Elapsed Time: ");
+        consolePrint((float)(millis() - startMS) / 1000);
+        consolePrintln("s");
+        
+        // the module stays in bootloader mode, it would only be detected (and updated) again
+        if (isUpdateFinished) {
+            consolePrintln("Please unplug the module to restart.");
+            
+            while (true) { }
+        }
     }
     else {
-        #if defined(LORA_RESET)
-        digitalWrite(LORA_RESET, LOW);
-        sodaq_wdt_safe_delay(100);
-        digitalWrite(LORA_RESET, HIGH);
-        sodaq_wdt_safe_delay(1000);
-        #endif
-        LORA_STREAM.end();
-        LORA_STREAM.begin(bootloader.getDefaultApplicationBaudRate());
-        sodaq_wdt_safe_delay(100);
-        LORA_STREAM.flush();
-        
-        char applicationResetResponse[64];
-        if (bootloader.applicationReset(applicationResetResponse, sizeof(applicationResetResponse))) {
-            consolePrintln("\n* The module is in Application mode: ");
-            consolePrintln(applicationResetResponse);
+        consolePrintln("\n* The module is in Application mode: ");
+        consolePrintln(applicationResetResponse);
 
-            consolePrintln("\nReady to start firmware update...");
-            consolePrint("Firmware Image: ");
-            consolePrintln(HexFileImageName);
-            consolePrintln("\nPlease press \'c\' to continue...");
+        if (isImageInstalled(applicationResetResponse)) {
+            consolePrint("\nThe module already runs the firmware of the image (");
+            consolePrint(HexFileImageVersion);
+            consolePrintln("), there is nothing to update.");
+            consolePrintln("Please press \'c\' to check the next module, or \'f\' to update this one anyway...");
             
-            while (CONSOLE_STREAM.read() != 'c') { }
+            int c;
+            while (((c = CONSOLE_STREAM.read()) != 'c') && (c != 'f')) { }
             
-            consolePrintln("Erasing firmware and attempting to start bootloader...");
+            if (c == 'c') {
+                // it would only be detected (and reset) again
+                consolePrintln("Please replace the module...");
+                waitForModuleRemoval(ModuleInApplicationMode);
+                
+                return;
+            }
+        }
+        
+        consolePrintln("\nReady to start firmware update...");
+        consolePrint("Firmware Image: ");
+        consolePrintln(HexFileImageName);
+        consolePrintln("\nPlease press \'c\' to continue...");
+        
+        while (CONSOLE_STREAM.read() != 'c') {
+            prepareImage();
+        }
+        
+        consolePrintln("Erasing firmware and attempting to start bootloader...");
+        bootloader.eraseFirmware();
+        sodaq_wdt_safe_delay(1000);
+        
+        shouldUseBootloaderMode = true;
+        isFirmwareErased = true;
+    }
+    #endif
+}
+
+#if defined(PRODUCTION_LINE_MODE)
+
+// waits for a module to be inserted, updates and verifies it, prints a record of the result and waits for the
+// module to be removed; the image stays verified and planned from one module to the next (see reuseErasePlan())
+void updateNextModule()
+{
+    char applicationResetResponse[64];
+    ModuleMode mode = ModuleNotResponding;
+    
+    consolePrintln("\n* Waiting for the next module...");
+    
+    // the empty socket is probed without resetting anything, the mode of a module is only detected once it responds
+    while (mode == ModuleNotResponding) {
+        while (!bootloader.isModuleResponding(ModuleInBootloaderMode) && !bootloader.isModuleResponding(ModuleInApplicationMode)) {
+            idle(ModulePollInterval);
+        }
+        
+        mode = bootloader.detectMode(applicationResetResponse, sizeof(applicationResetResponse));
+    }
+    
+    uint32_t startMS = millis();
+    const char* result = "updated";
+    const char* failure = 0;
+    bool isFlashErased = false;
+    
+    moduleCount++;
+    
+    if (mode == ModuleInApplicationMode) {
+        consolePrintln("\n* The module is in Application mode: ");
+        consolePrintln(applicationResetResponse);
+        
+        if (isImageInstalled(applicationResetResponse)) {
+            result = "already up to date";
+        }
+        else {
             bootloader.eraseFirmware();
             sodaq_wdt_safe_delay(1000);
             
-            shouldUseBootloaderMode = true;
+            mode = ModuleInBootloaderMode;
+            isFlashErased = true;
+        }
+    }
+    
+    if (mode == ModuleInBootloaderMode) {
+        BootloaderVersionInfo versionInfo;
+        
+        // back at the baud rate of the bootloader after the application
+        bootloader.resetSessionBaudRate();
+        
+        if (bootloader.getVersionInfo(versionInfo)) {
+            // the checkpoint could be that of another module
+            failure = updateFirmware(versionInfo, isFlashErased, false);
         }
         else {
-            consolePrintln("The module did not respond in application mode. Please unplug and retry in bootloader mode.");
+            failure = "The module did not respond in bootloader mode.";
         }
     }
+    
+    if (!failure) {
+        passedModuleCount++;
+    }
+    
+    // a single line per module, for the records of the production line
+    consolePrint("\nModule ");
+    consolePrint(moduleCount);
+    consolePrint(failure ? ": FAIL (" : ": PASS (");
+    consolePrint(failure ? failure : result);
+    consolePrint(") in ");
+    consolePrint((float)(millis() - startMS) / 1000);
+    consolePrint("s, ");
+    consolePrint(passedModuleCount);
+    consolePrint(" of ");
+    consolePrint(moduleCount);
+    consolePrintln(" passed");
+    
+    consolePrintln("Please remove the module.");
+    
+    // an updated module stays in bootloader mode, one that was up to date still runs its application
+    waitForModuleRemoval(mode);
 }
+
+#endif
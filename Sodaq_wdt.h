@@ -43,6 +43,20 @@ enum wdt_period : uint8_t
   WDT_PERIOD_4X     = 9,   // 4096 cycles = 4s
   WDT_PERIOD_8X     = 10   // 8192 cycles = 8s
   
+#elif defined(ARDUINO_HOST)
+
+  // The host build has no watchdog, the values are only placeholders
+  WDT_PERIOD_1DIV64 = 1,
+  WDT_PERIOD_1DIV32 = 2,
+  WDT_PERIOD_1DIV16 = 3,
+  WDT_PERIOD_1DIV8  = 4,
+  WDT_PERIOD_1DIV4  = 5,
+  WDT_PERIOD_1DIV2  = 6,
+  WDT_PERIOD_1X     = 7,
+  WDT_PERIOD_2X     = 8,
+  WDT_PERIOD_4X     = 9,
+  WDT_PERIOD_8X     = 10
+  
 #endif
 };
 
@@ -29,6 +29,8 @@
 #define HEX_CHAR_TO_NIBBLE(c) ((c >= 'A') ? (c - 'A' + 0x0A) : (c - '0'))
 #define HEX_PAIR_TO_BYTE(h, l) ((HEX_CHAR_TO_NIBBLE(h) << 4) + HEX_CHAR_TO_NIBBLE(l))
 
+#define BYTES_TO_UINT16(LSB, MSB) ((uint16_t)(((uint8_t)(MSB) << 8) | (uint8_t)(LSB)))
+
 #define ARRAY_SIZE(a) (sizeof(a)/sizeof(a[0]))
 
 #endif
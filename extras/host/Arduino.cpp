@@ -0,0 +1,354 @@
+/*
+ * Arduino.cpp
+ *
+ * Host implementations of the Arduino core functions and classes declared in
+ * Arduino.h.
+ */
+
+#include "Arduino.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <time.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+
+static uint64_t monotonicMicros()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+static const uint64_t startMicros = monotonicMicros();
+
+static bool isVirtualClock = false;
+static uint64_t virtualMicros = 0;
+static uint32_t virtualYieldMicros = 0;
+
+static uint64_t hostMicros()
+{
+    return isVirtualClock ? virtualMicros : monotonicMicros() - startMicros;
+}
+
+void setVirtualClock(bool isEnabled, uint32_t yieldMicros)
+{
+    isVirtualClock = isEnabled;
+    virtualMicros = 0;
+    virtualYieldMicros = yieldMicros;
+}
+
+uint32_t millis()
+{
+    return (uint32_t)(hostMicros() / 1000);
+}
+
+uint32_t micros()
+{
+    return (uint32_t)hostMicros();
+}
+
+void delay(uint32_t ms)
+{
+    if (isVirtualClock) {
+        virtualMicros += (uint64_t)ms * 1000;
+        return;
+    }
+
+    struct timespec ts;
+    ts.tv_sec = ms / 1000;
+    ts.tv_nsec = (ms % 1000) * 1000000L;
+
+    while (nanosleep(&ts, &ts) != 0) { }
+}
+
+void yield()
+{
+    if (isVirtualClock) {
+        virtualMicros += virtualYieldMicros;
+    }
+}
+
+size_t Print::write(const uint8_t* buffer, size_t size)
+{
+    size_t n = 0;
+
+    while (size--) {
+        n += write(*buffer++);
+    }
+
+    return n;
+}
+
+size_t Print::print(unsigned long n, int base)
+{
+    char buffer[8 * sizeof(long) + 1];
+    char* str = &buffer[sizeof(buffer) - 1];
+
+    *str = '\0';
+
+    if (base < 2) {
+        base = 10;
+    }
+
+    do {
+        char c = n % base;
+        n /= base;
+
+        *--str = c < 10 ? c + '0' : c + 'A' - 10;
+    } while (n);
+
+    return write(str);
+}
+
+size_t Print::print(long n, int base)
+{
+    if (base == DEC && n < 0) {
+        return print('-') + print((unsigned long)-n, base);
+    }
+
+    return print((unsigned long)n, base);
+}
+
+size_t Print::print(double n, int digits)
+{
+    char buffer[32];
+    snprintf(buffer, sizeof(buffer), "%.*f", digits, n);
+
+    return write(buffer);
+}
+
+int Stream::timedRead()
+{
+    uint32_t start = millis();
+
+    do {
+        int c = read();
+
+        if (c >= 0) {
+            return c;
+        }
+
+        yield();
+    } while (millis() - start < timeout);
+
+    return -1;
+}
+
+size_t Stream::readBytes(uint8_t* buffer, size_t length)
+{
+    size_t count = 0;
+
+    while (count < length) {
+        int c = timedRead();
+
+        if (c < 0) {
+            break;
+        }
+
+        *buffer++ = (uint8_t)c;
+        count++;
+    }
+
+    return count;
+}
+
+size_t Stream::readBytesUntil(char terminator, char* buffer, size_t length)
+{
+    size_t index = 0;
+
+    while (index < length) {
+        int c = timedRead();
+
+        if (c < 0 || c == terminator) {
+            break;
+        }
+
+        *buffer++ = (char)c;
+        index++;
+    }
+
+    return index;
+}
+
+Uart Serial(STDIN_FILENO, STDOUT_FILENO);
+Uart Serial1;
+
+static speed_t toSpeed(unsigned long baudRate)
+{
+    switch (baudRate) {
+        case 9600: return B9600;
+        case 19200: return B19200;
+        case 38400: return B38400;
+        case 57600: return B57600;
+        case 115200: return B115200;
+        case 230400: return B230400;
+        case 460800: return B460800;
+        case 921600: return B921600;
+        default: return B0;
+    }
+}
+
+Uart::Uart(const char* devicePath) :
+    devicePath(devicePath),
+    serialDevice(0),
+    readFd(-1),
+    writeFd(-1),
+    isDevice(true),
+    rxHead(0),
+    rxTail(0)
+{
+}
+
+Uart::Uart(int readFd, int writeFd) :
+    devicePath(0),
+    serialDevice(0),
+    readFd(readFd),
+    writeFd(writeFd),
+    isDevice(false),
+    rxHead(0),
+    rxTail(0)
+{
+}
+
+void Uart::begin(unsigned long baudRate)
+{
+    if (serialDevice) {
+        serialDevice->setBaudRate(baudRate);
+        return;
+    }
+
+    if (!isDevice) {
+        return;
+    }
+
+    end();
+
+    speed_t speed = toSpeed(baudRate);
+
+    if (!devicePath || speed == B0) {
+        fprintf(stderr, "Uart: cannot open %s at %lu baud\n", devicePath ? devicePath : "(no device)", baudRate);
+        return;
+    }
+
+    int fd = open(devicePath, O_RDWR | O_NOCTTY | O_NONBLOCK);
+
+    if (fd < 0) {
+        perror(devicePath);
+        return;
+    }
+
+    struct termios tty;
+
+    if (tcgetattr(fd, &tty) == 0) {
+        cfmakeraw(&tty);
+        tty.c_cflag |= CLOCAL | CREAD;
+        tty.c_cflag &= ~(CSTOPB | CRTSCTS);
+        cfsetispeed(&tty, speed);
+        cfsetospeed(&tty, speed);
+        tcsetattr(fd, TCSANOW, &tty);
+    }
+
+    readFd = fd;
+    writeFd = fd;
+}
+
+void Uart::end()
+{
+    if (isDevice && readFd >= 0) {
+        close(readFd);
+        readFd = -1;
+        writeFd = -1;
+    }
+
+    rxHead = 0;
+    rxTail = 0;
+}
+
+// reads whatever is pending without blocking, returns the number of buffered bytes
+// takes in everything received so far, as the interrupt handler of a board does, so that available() counts all of it
+size_t Uart::fillRxBuffer()
+{
+    if (rxHead > 0) {
+        memmove(rxBuffer, &rxBuffer[rxHead], rxTail - rxHead);
+        rxTail -= rxHead;
+        rxHead = 0;
+    }
+
+    if (rxTail < sizeof(rxBuffer) && serialDevice) {
+        rxTail += serialDevice->transmit(&rxBuffer[rxTail], sizeof(rxBuffer) - rxTail);
+    }
+    else if (rxTail < sizeof(rxBuffer) && readFd >= 0) {
+        struct pollfd pfd = { readFd, POLLIN, 0 };
+
+        if (poll(&pfd, 1, 0) > 0 && (pfd.revents & POLLIN)) {
+            ssize_t n = ::read(readFd, &rxBuffer[rxTail], sizeof(rxBuffer) - rxTail);
+
+            rxTail += n > 0 ? n : 0;
+        }
+    }
+
+    return rxTail - rxHead;
+}
+
+int Uart::available()
+{
+    return fillRxBuffer();
+}
+
+int Uart::read()
+{
+    return (rxHead < rxTail || fillRxBuffer() > 0) ? rxBuffer[rxHead++] : -1;
+}
+
+int Uart::peek()
+{
+    return (rxHead < rxTail || fillRxBuffer() > 0) ? rxBuffer[rxHead] : -1;
+}
+
+size_t Uart::write(const uint8_t* buffer, size_t size)
+{
+    if (serialDevice) {
+        serialDevice->receive(buffer, size);
+        return size;
+    }
+
+    size_t count = 0;
+
+    while (writeFd >= 0 && count < size) {
+        ssize_t n = ::write(writeFd, buffer + count, size - count);
+
+        if (n > 0) {
+            count += n;
+        }
+        else if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+            break; // the device has gone away (e.g. the simulator exited)
+        }
+        else {
+            struct pollfd pfd = { writeFd, POLLOUT, 0 };
+
+            if (poll(&pfd, 1, timeout) <= 0) {
+                break;
+            }
+        }
+    }
+
+    return count;
+}
+
+void Uart::flush()
+{
+    if (serialDevice) {
+        return;
+    }
+
+    if (isDevice && writeFd >= 0) {
+        tcdrain(writeFd);
+    }
+    else {
+        fflush(stdout);
+    }
+}
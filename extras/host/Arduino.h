@@ -0,0 +1,156 @@
+/*
+ * Arduino.h
+ *
+ * Minimal host (Linux) stand-in for the Arduino core, just enough to
+ * compile the updater sources unchanged for off-target benchmarking and
+ * for running the updater itself against a serial port (see Uart).
+ */
+
+#ifndef HOST_ARDUINO_H_
+#define HOST_ARDUINO_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#define ARDUINO_HOST
+
+#define DEC 10
+#define HEX 16
+
+#ifndef min
+#define min(a, b) ((a) < (b) ? (a) : (b))
+#endif
+
+#ifndef max
+#define max(a, b) ((a) > (b) ? (a) : (b))
+#endif
+
+uint32_t millis();
+uint32_t micros();
+void delay(uint32_t ms);
+void yield();
+
+// Host only: the clock starts at 0 and only advances through delay() and yield(), which
+// then advances it by the given step (see update_bench.cpp), or runs in real time again
+void setVirtualClock(bool isEnabled, uint32_t yieldMicros = 10);
+
+class Print
+{
+    public:
+        virtual ~Print() { }
+
+        virtual size_t write(uint8_t b) = 0;
+        virtual size_t write(const uint8_t* buffer, size_t size);
+        virtual void flush() { }
+
+        size_t write(const char* str) { return write((const uint8_t*)str, strlen(str)); }
+
+        size_t print(const char* str) { return write(str); }
+        size_t print(char c) { return write((uint8_t)c); }
+        size_t print(unsigned long n, int base = DEC);
+        size_t print(long n, int base = DEC);
+        size_t print(unsigned int n, int base = DEC) { return print((unsigned long)n, base); }
+        size_t print(int n, int base = DEC) { return print((long)n, base); }
+        size_t print(unsigned char n, int base = DEC) { return print((unsigned long)n, base); }
+        size_t print(double n, int digits = 2);
+
+        size_t println() { return write("\r\n"); }
+
+        template<typename T>
+        size_t println(T value) { return print(value) + println(); }
+
+        template<typename T>
+        size_t println(T value, int format) { return print(value, format) + println(); }
+};
+
+class Stream : public Print
+{
+    public:
+        Stream() : timeout(1000) { }
+
+        virtual int available() = 0;
+        virtual int read() = 0;
+        virtual int peek() = 0;
+
+        void setTimeout(unsigned long ms) { timeout = ms; }
+
+        size_t readBytes(uint8_t* buffer, size_t length);
+        size_t readBytes(char* buffer, size_t length) { return readBytes((uint8_t*)buffer, length); }
+        size_t readBytesUntil(char terminator, char* buffer, size_t length);
+    protected:
+        unsigned long timeout;
+
+        int timedRead();
+};
+
+// Host only: the other end of a Uart that is attached to an in-process device instead
+class HostSerialDevice
+{
+    public:
+        virtual ~HostSerialDevice() { }
+
+        virtual void setBaudRate(uint32_t baudRate) = 0;
+
+        // the bytes the Uart writes
+        virtual void receive(const uint8_t* buffer, size_t size) = 0;
+
+        // the bytes the Uart can read by now
+        virtual size_t transmit(uint8_t* buffer, size_t size) = 0;
+};
+
+// A serial port backed by file descriptors: either a tty device, which begin() opens
+// and configures raw (8N1) at the given baud rate, or the standard input and output.
+// It can also be attached to a HostSerialDevice.
+class Uart : public Stream
+{
+    public:
+        // the device is opened by begin(), see setDevice()
+        explicit Uart(const char* devicePath = 0);
+
+        // uses the given, already open, file descriptors (begin() and end() don't touch them)
+        Uart(int readFd, int writeFd);
+
+        void setDevice(const char* devicePath) { this->devicePath = devicePath; }
+
+        // replaces the tty device (0 to detach again)
+        void attach(HostSerialDevice* serialDevice) { this->serialDevice = serialDevice; }
+
+        void begin(unsigned long baudRate);
+        void end();
+
+        int available();
+        int read();
+        int peek();
+
+        size_t write(uint8_t b) { return write(&b, 1); }
+        size_t write(const uint8_t* buffer, size_t size);
+        using Print::write;
+        void flush();
+
+        operator bool() { return serialDevice || writeFd >= 0; }
+    private:
+        const char* devicePath;
+        HostSerialDevice* serialDevice;
+        int readFd;
+        int writeFd;
+        bool isDevice;
+
+        uint8_t rxBuffer[256];
+        size_t rxHead;
+        size_t rxTail;
+
+        size_t fillRxBuffer();
+};
+
+// the console on the standard input and output
+extern Uart Serial;
+
+// the module, the device has to be set before begin() is called
+extern Uart Serial1;
+
+#define SERIAL_PORT_MONITOR Serial
+
+#endif /* HOST_ARDUINO_H_ */
@@ -0,0 +1,570 @@
+/*
+ * BootloaderSimulator.cpp
+ *
+ * See BootloaderSimulator.h.
+ */
+
+#include "BootloaderSimulator.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#define LE16(p) ((uint16_t)((p)[0] | ((p)[1] << 8)))
+#define LE32(p) ((uint32_t)((p)[0] | ((p)[1] << 8) | ((uint32_t)(p)[2] << 16) | ((uint32_t)(p)[3] << 24)))
+
+enum SimulatorCommand {
+    SimGetVersionInfo = 0x00,
+    SimReadFlash = 0x01,
+    SimWriteFlash = 0x02,
+    SimEraseFlash = 0x03,
+    SimReadEe = 0x04,
+    SimWriteEe = 0x05,
+    SimReadConfig = 0x06,
+    SimWriteConfig = 0x07,
+    SimCalculateChecksum = 0x08,
+    SimResetDevice = 0x09
+};
+
+BootloaderSimulator::BootloaderSimulator() :
+    isBootloaderMode(false),
+    lineBaudRate(0),
+    frameLength(0),
+    isFrameGarbled(false),
+    lineInMicros(0),
+    outputHead(0),
+    outputTail(0),
+    outputStartMicros(0),
+    receivedByteCount(0)
+{
+    getDefaultConfig(config);
+    clearStats();
+
+    memset(programMemory, 0xFF, sizeof(programMemory));
+    memset(userId, 0xFF, sizeof(userId));
+    memset(configWords, 0xFF, sizeof(configWords));
+    memset(eeprom, 0xFF, sizeof(eeprom));
+}
+
+void BootloaderSimulator::getDefaultConfig(SimulatorConfig& config)
+{
+    memset(&config, 0, sizeof(config));
+
+    config.BootloaderVersion = 0x0100;
+    config.DeviceId = 0x5400; // PIC18LF46K22
+    config.MaxPacketSize = 0;
+    config.EraseRowSize = 64;
+    config.WriteLatchSize = 64;
+
+    config.MaxBaudRate = 230400;
+    config.ApplicationBaudRate = 57600;
+
+    config.EraseRowMicros = 2500;
+    config.WriteLatchMicros = 2000;
+    config.EepromByteMicros = 4000;
+    config.ChecksumByteMicros = 1;
+    config.CommandMicros = 50;
+    config.ApplicationResetMicros = 100000;
+    config.FrameTimeoutMicros = 100000;
+
+    strcpy(config.ApplicationBanner, "RN2483 1.0.1 Dec 15 2015 09:38:09");
+}
+
+void BootloaderSimulator::clearStats()
+{
+    memset(&stats, 0, sizeof(stats));
+}
+
+void BootloaderSimulator::powerOn(bool isBootloaderModeForced)
+{
+    isBootloaderMode = isBootloaderModeForced || !hasApplication();
+    frameLength = 0;
+    isFrameGarbled = false;
+    outputHead = 0;
+    outputTail = 0;
+}
+
+bool BootloaderSimulator::hasApplication()
+{
+    // the reset vector of the application is at the start of the first row after the bootloader
+    for (size_t i = SIM_BOOTLOADER_END; i < (size_t)SIM_BOOTLOADER_END + config.EraseRowSize; i++) {
+        if (programMemory[i] != 0xFF) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+uint8_t* BootloaderSimulator::getMemory(uint32_t address, size_t size)
+{
+    if (address + size <= SIM_PROGRAM_MEMORY_SIZE) {
+        return &programMemory[address];
+    }
+
+    if (address >= SIM_USER_ID_ADDRESS && address + size <= SIM_USER_ID_ADDRESS + SIM_USER_ID_SIZE) {
+        return &userId[address - SIM_USER_ID_ADDRESS];
+    }
+
+    if (address >= SIM_CONFIG_ADDRESS && address + size <= SIM_CONFIG_ADDRESS + SIM_CONFIG_SIZE) {
+        return &configWords[address - SIM_CONFIG_ADDRESS];
+    }
+
+    return 0;
+}
+
+void BootloaderSimulator::receive(uint8_t b, uint64_t nowMicros)
+{
+    stats.BytesReceived++;
+
+    poll(nowMicros);
+
+    // the byte only arrives once the line has carried the previous ones
+    lineInMicros = (nowMicros > lineInMicros ? nowMicros : lineInMicros) + getByteMicros();
+
+    if (isBootloaderMode) {
+        receivedByteCount++;
+
+        if (config.ByteLossInterval != 0 && receivedByteCount % config.ByteLossInterval == 0) {
+            stats.LostByteCount++;
+
+            return;
+        }
+
+        receiveBootloader(b);
+    }
+    else {
+        receiveApplication(b);
+    }
+}
+
+void BootloaderSimulator::poll(uint64_t nowMicros)
+{
+    if (frameLength > 0 && nowMicros > lineInMicros + config.FrameTimeoutMicros) {
+        if (isBootloaderMode) {
+            stats.DroppedFrameCount++;
+        }
+
+        frameLength = 0;
+        isFrameGarbled = false;
+    }
+}
+
+void BootloaderSimulator::receiveBootloader(uint8_t b)
+{
+    if (frameLength == 0) {
+        // waiting for the autobaud character, which can't be measured above the maximum baud rate
+        if (b != 0x55) {
+            return;
+        }
+
+        isFrameGarbled = lineBaudRate > config.MaxBaudRate;
+    }
+
+    // the bytes of a garbled frame are still consumed, so that the frame timeout applies to all of them
+    if (frameLength < sizeof(frame)) {
+        frame[frameLength] = b;
+    }
+
+    frameLength++;
+
+    if (frameLength < SIM_HEADER_SIZE) {
+        return;
+    }
+
+    if (frameLength == SIM_HEADER_SIZE && (frame[4] != 0x55 || frame[5] != 0xAA)) {
+        stats.DroppedFrameCount++;
+        frameLength = 0;
+
+        return;
+    }
+
+    uint8_t command = frame[1];
+    size_t dataLength = 0;
+
+    if (command == SimWriteFlash || command == SimWriteEe || command == SimWriteConfig) {
+        dataLength = LE16(&frame[2]);
+    }
+
+    if (frameLength < SIM_HEADER_SIZE + dataLength) {
+        return;
+    }
+
+    if (isFrameGarbled || dataLength > getMaxPacketData()) {
+        stats.DroppedFrameCount++;
+    }
+    else {
+        stats.FrameCount++;
+        executeCommand();
+    }
+
+    frameLength = 0;
+    isFrameGarbled = false;
+}
+
+size_t BootloaderSimulator::getMaxPacketData()
+{
+    size_t maxData = config.EraseRowSize;
+
+    if (config.MaxPacketSize > SIM_HEADER_SIZE) {
+        maxData = config.MaxPacketSize - SIM_HEADER_SIZE;
+    }
+
+    return maxData < SIM_MAX_PACKET_DATA ? maxData : SIM_MAX_PACKET_DATA;
+}
+
+void BootloaderSimulator::receiveApplication(uint8_t b)
+{
+    // the application doesn't autobaud
+    if (lineBaudRate != config.ApplicationBaudRate) {
+        return;
+    }
+
+    if (b != '\n') {
+        if (frameLength < sizeof(frame) - 1) {
+            frame[frameLength++] = b;
+        }
+
+        return;
+    }
+
+    if (frameLength > 0 && frame[frameLength - 1] == '\r') {
+        frameLength--;
+    }
+
+    frame[frameLength] = 0;
+    frameLength = 0;
+
+    const char* line = (const char*)frame;
+    char response[SIM_MAX_BANNER_LENGTH + 3];
+
+    if (strcmp(line, "sys reset") == 0) {
+        snprintf(response, sizeof(response), "%s\r\n", config.ApplicationBanner);
+        respond((const uint8_t*)response, strlen(response), config.ApplicationResetMicros);
+    }
+    else if (strcmp(line, "sys get ver") == 0) {
+        snprintf(response, sizeof(response), "%s\r\n", config.ApplicationBanner);
+        respond((const uint8_t*)response, strlen(response), config.CommandMicros);
+    }
+    else if (strcmp(line, "sys eraseFW") == 0) {
+        // no response, the module restarts in the bootloader
+        memset(&programMemory[SIM_BOOTLOADER_END], 0xFF, SIM_PROGRAM_MEMORY_SIZE - SIM_BOOTLOADER_END);
+        isBootloaderMode = true;
+    }
+    else {
+        respond((const uint8_t*)"invalid_param\r\n", 15, config.CommandMicros);
+    }
+}
+
+void BootloaderSimulator::executeCommand()
+{
+    uint8_t command = frame[1];
+    uint16_t length = LE16(&frame[2]);
+    uint32_t address = LE32(&frame[6]);
+    const uint8_t* data = &frame[SIM_HEADER_SIZE];
+
+    uint8_t response[SIM_OUTPUT_BUFFER_SIZE];
+    size_t responseLength = SIM_HEADER_SIZE;
+    uint32_t latencyMicros = 0;
+
+    memcpy(response, frame, SIM_HEADER_SIZE);
+
+    if (command < sizeof(stats.CommandCounts) / sizeof(stats.CommandCounts[0])) {
+        stats.CommandCounts[command]++;
+    }
+
+    switch (command) {
+        case SimGetVersionInfo: {
+            uint8_t* info = &response[SIM_HEADER_SIZE];
+
+            memset(info, 0, 16);
+            info[0] = (uint8_t)config.BootloaderVersion;
+            info[1] = (uint8_t)(config.BootloaderVersion >> 8);
+            info[2] = (uint8_t)config.MaxPacketSize;
+            info[3] = (uint8_t)(config.MaxPacketSize >> 8);
+            info[6] = (uint8_t)config.DeviceId;
+            info[7] = (uint8_t)(config.DeviceId >> 8);
+            info[10] = config.EraseRowSize;
+            info[11] = config.WriteLatchSize;
+            memcpy(&info[12], userId, 4);
+
+            responseLength += 16;
+            break;
+        }
+
+        case SimReadFlash:
+        case SimReadEe:
+        case SimReadConfig: {
+            const uint8_t* memory = 0;
+
+            if (command == SimReadFlash) {
+                memory = getMemory(address, length);
+            }
+            else if (command == SimReadEe) {
+                memory = (address + length <= SIM_EEPROM_SIZE) ? &eeprom[address] : 0;
+            }
+            else if (address >= SIM_CONFIG_ADDRESS) {
+                memory = getMemory(address, length);
+            }
+
+            if (memory && length <= SIM_MAX_PACKET_DATA) {
+                memcpy(&response[SIM_HEADER_SIZE], memory, length);
+                responseLength += length;
+            }
+            else {
+                response[responseLength++] = SIM_STATUS_ADDRESS_ERROR;
+            }
+
+            break;
+        }
+
+        case SimWriteFlash:
+            response[responseLength++] = writeFlash(address, data, length, latencyMicros);
+            break;
+
+        case SimEraseFlash:
+            response[responseLength++] = eraseFlash(address, length, latencyMicros);
+            break;
+
+        case SimWriteEe:
+        case SimWriteConfig: {
+            uint8_t* memory = 0;
+
+            if (command == SimWriteEe) {
+                memory = (address + length <= SIM_EEPROM_SIZE) ? &eeprom[address] : 0;
+            }
+            else if (address >= SIM_CONFIG_ADDRESS) {
+                memory = getMemory(address, length);
+            }
+
+            if (memory) {
+                memcpy(memory, data, length);
+                latencyMicros = length * config.EepromByteMicros;
+                response[responseLength++] = SIM_STATUS_SUCCESS;
+            }
+            else {
+                response[responseLength++] = SIM_STATUS_ADDRESS_ERROR;
+            }
+
+            break;
+        }
+
+        case SimCalculateChecksum: {
+            const uint8_t* memory = getMemory(address, length);
+            uint16_t checksum = 0;
+
+            if (!memory) {
+                response[responseLength++] = SIM_STATUS_ADDRESS_ERROR;
+                break;
+            }
+
+            for (size_t i = 0; i + 1 < length; i += 2) {
+                checksum += LE16(&memory[i]);
+            }
+
+            latencyMicros = length * config.ChecksumByteMicros;
+            response[responseLength++] = (uint8_t)checksum;
+            response[responseLength++] = (uint8_t)(checksum >> 8);
+            break;
+        }
+
+        case SimResetDevice:
+            // no response, the application starts if there is one
+            powerOn();
+            return;
+
+        default:
+            response[responseLength++] = SIM_STATUS_UNSUPPORTED;
+            break;
+    }
+
+    respond(response, responseLength, config.CommandMicros + latencyMicros);
+}
+
+uint8_t BootloaderSimulator::eraseFlash(uint32_t address, uint16_t rowCount, uint32_t& latencyMicros)
+{
+    size_t rowSize = config.EraseRowSize;
+
+    // the ID and configuration locations are smaller than a row
+    if ((address == SIM_USER_ID_ADDRESS || address == SIM_CONFIG_ADDRESS) && rowCount == 1) {
+        memset(getMemory(address, 1), 0xFF, address == SIM_USER_ID_ADDRESS ? SIM_USER_ID_SIZE : SIM_CONFIG_SIZE);
+    }
+    else if (address % rowSize != 0 || address < SIM_BOOTLOADER_END || !getMemory(address, rowCount * rowSize)) {
+        return SIM_STATUS_ADDRESS_ERROR;
+    }
+    else {
+        memset(&programMemory[address], 0xFF, rowCount * rowSize);
+    }
+
+    stats.ErasedRowCount += rowCount;
+    latencyMicros = rowCount * config.EraseRowMicros;
+
+    return SIM_STATUS_SUCCESS;
+}
+
+uint8_t BootloaderSimulator::writeFlash(uint32_t address, const uint8_t* data, uint16_t size, uint32_t& latencyMicros)
+{
+    size_t latchSize = config.WriteLatchSize;
+
+    // a whole latch can be written to the ID and configuration locations, only what fits is kept
+    if (address == SIM_USER_ID_ADDRESS && size > SIM_USER_ID_SIZE) {
+        size = SIM_USER_ID_SIZE;
+    }
+    else if (address == SIM_CONFIG_ADDRESS && size > SIM_CONFIG_SIZE) {
+        size = SIM_CONFIG_SIZE;
+    }
+
+    uint8_t* memory = getMemory(address, size);
+
+    if (!memory || address < SIM_BOOTLOADER_END) {
+        return SIM_STATUS_ADDRESS_ERROR;
+    }
+
+    if (address < SIM_PROGRAM_MEMORY_SIZE && (address % latchSize != 0 || size % latchSize != 0)) {
+        return SIM_STATUS_ADDRESS_ERROR;
+    }
+
+    // programming can only clear bits, anything that was not erased first stays corrupted
+    for (size_t i = 0; i < size; i++) {
+        memory[i] &= data[i];
+    }
+
+    uint32_t latchCount = (size + latchSize - 1) / latchSize;
+
+    stats.WrittenLatchCount += latchCount;
+    latencyMicros = latchCount * config.WriteLatchMicros;
+
+    return SIM_STATUS_SUCCESS;
+}
+
+void BootloaderSimulator::respond(const uint8_t* data, size_t size, uint32_t latencyMicros)
+{
+    stats.ResponseWaitMicros += latencyMicros + size * getByteMicros();
+
+    if (outputHead == outputTail) {
+        outputHead = 0;
+        outputTail = 0;
+        outputStartMicros = lineInMicros + latencyMicros;
+    }
+    else if (outputHead > 0) {
+        memmove(output, &output[outputHead], outputTail - outputHead);
+        outputTail -= outputHead;
+        outputHead = 0;
+    }
+
+    if (size > sizeof(output) - outputTail) {
+        size = sizeof(output) - outputTail;
+    }
+
+    memcpy(&output[outputTail], data, size);
+    outputTail += size;
+}
+
+uint64_t BootloaderSimulator::getNextOutputMicros()
+{
+    return outputHead < outputTail ? outputStartMicros + getByteMicros() : UINT64_MAX;
+}
+
+size_t BootloaderSimulator::transmit(uint8_t* buffer, size_t size, uint64_t nowMicros)
+{
+    size_t count = 0;
+
+    while (count < size && outputHead < outputTail && outputStartMicros + getByteMicros() <= nowMicros) {
+        buffer[count++] = output[outputHead++];
+        outputStartMicros += getByteMicros();
+    }
+
+    stats.BytesSent += count;
+
+    return count;
+}
+
+static int hexNibble(char c)
+{
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+
+    if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+
+    return -1;
+}
+
+bool BootloaderSimulator::loadHexRecord(const char* record, uint32_t& extendedAddress)
+{
+    uint8_t bytes[5 + 255];
+    size_t count = 0;
+    uint8_t sum = 0;
+
+    while (count < sizeof(bytes) && hexNibble(record[0]) >= 0 && hexNibble(record[1]) >= 0) {
+        bytes[count] = (hexNibble(record[0]) << 4) | hexNibble(record[1]);
+        sum += bytes[count++];
+        record += 2;
+    }
+
+    if (count < 5 || count != (size_t)bytes[0] + 5 || sum != 0) {
+        return false;
+    }
+
+    uint32_t address = extendedAddress + ((bytes[1] << 8) | bytes[2]);
+
+    switch (bytes[3]) {
+        case 0x00: {
+            uint8_t* memory = getMemory(address, bytes[0]);
+
+            if (!memory) {
+                return false;
+            }
+
+            memcpy(memory, &bytes[4], bytes[0]);
+            break;
+        }
+
+        case 0x04:
+            extendedAddress = (uint32_t)((bytes[4] << 8) | bytes[5]) << 16;
+            break;
+
+        default:
+            break;
+    }
+
+    return true;
+}
+
+bool BootloaderSimulator::loadHexFile(const char* path)
+{
+    FILE* file = fopen(path, "r");
+
+    if (!file) {
+        perror(path);
+        return false;
+    }
+
+    char line[1024];
+    uint32_t extendedAddress = 0;
+    size_t recordCount = 0;
+    bool isValid = true;
+
+    while (isValid && fgets(line, sizeof(line), file)) {
+        const char* record = strchr(line, ':');
+
+        if (record) {
+            isValid = loadHexRecord(record + 1, extendedAddress);
+            recordCount++;
+        }
+    }
+
+    fclose(file);
+
+    if (!isValid || recordCount == 0) {
+        fprintf(stderr, "%s: not a valid Intel HEX image\n", path);
+        return false;
+    }
+
+    return true;
+}
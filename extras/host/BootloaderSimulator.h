@@ -0,0 +1,170 @@
+/*
+ * BootloaderSimulator.h
+ *
+ * Host model of an RN2483/RN2903 module: the PIC18 bootloader protocol as
+ * spoken by Sodaq_RN2483Bootloader, the flash contents and the serial line.
+ *
+ * The model is driven by a clock given by the caller (in microseconds), so it
+ * can run against a real pty (see bootloader_sim.cpp) as well as in-process
+ * on a virtual clock. Every byte takes 10 bit times on the line, both ways,
+ * and each command only completes after its erase/write latency, after which
+ * the response is sent out at the line rate.
+ *
+ * Memory map (PIC18LF46K22):
+ *  - program memory 0x000000 - 0x00FFFF, the bootloader itself below 0x300
+ *  - user ID        0x200000 - 0x200007
+ *  - configuration  0x300000 - 0x30000D
+ *  - EEPROM         0x0000 - 0x03FF (Read/WriteEe commands only)
+ *
+ * Simplifications: the ID and configuration locations are erased and written
+ * like program memory (a write of a whole latch keeps only what fits), and a
+ * partial frame is dropped once the line has been idle for the frame timeout
+ * (so that a client can resynchronize). A frame with more data than the
+ * reported maximum packet size allows (one erase row if none is reported) is
+ * dropped, as it would overflow the buffer of the bootloader. Lost bytes can be injected to exercise
+ * the recovery of a client (see SimulatorConfig::ByteLossInterval).
+ */
+
+#ifndef BOOTLOADER_SIMULATOR_H_
+#define BOOTLOADER_SIMULATOR_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define SIM_PROGRAM_MEMORY_SIZE 0x10000
+#define SIM_BOOTLOADER_END 0x300
+#define SIM_USER_ID_ADDRESS 0x200000
+#define SIM_USER_ID_SIZE 8
+#define SIM_CONFIG_ADDRESS 0x300000
+#define SIM_CONFIG_SIZE 14
+#define SIM_EEPROM_SIZE 0x400
+
+#define SIM_HEADER_SIZE 10
+#define SIM_MAX_PACKET_DATA 0x1000
+#define SIM_OUTPUT_BUFFER_SIZE (SIM_HEADER_SIZE + SIM_MAX_PACKET_DATA)
+#define SIM_MAX_BANNER_LENGTH 63
+
+#define SIM_STATUS_SUCCESS 0x01
+#define SIM_STATUS_UNSUPPORTED 0xFF
+#define SIM_STATUS_ADDRESS_ERROR 0xFE
+
+struct SimulatorConfig {
+    uint16_t BootloaderVersion;
+    uint16_t DeviceId;
+    uint16_t MaxPacketSize; // as reported in the version info, 0 for "not reported"
+    uint8_t EraseRowSize;
+    uint8_t WriteLatchSize;
+
+    uint32_t MaxBaudRate; // frames sent faster than this are not recognized by the autobaud
+    uint32_t ApplicationBaudRate;
+
+    uint32_t EraseRowMicros;
+    uint32_t WriteLatchMicros;
+    uint32_t EepromByteMicros; // EEPROM and configuration words are written per byte
+    uint32_t ChecksumByteMicros;
+    uint32_t CommandMicros; // decoding and dispatching any command
+    uint32_t ApplicationResetMicros; // from "sys reset" to the banner
+    uint32_t FrameTimeoutMicros;
+
+    uint32_t ByteLossInterval; // every nth byte received in bootloader mode is lost, 0 for none
+
+    char ApplicationBanner[SIM_MAX_BANNER_LENGTH + 1];
+};
+
+struct SimulatorStats {
+    uint32_t FrameCount;
+    uint32_t DroppedFrameCount;
+    uint32_t LostByteCount;
+    uint32_t CommandCounts[10];
+    uint32_t ErasedRowCount;
+    uint32_t WrittenLatchCount;
+    uint32_t BytesReceived;
+    uint32_t BytesSent;
+    uint64_t ResponseWaitMicros; // from the last byte of a command until its response has arrived
+};
+
+class BootloaderSimulator
+{
+    public:
+        BootloaderSimulator();
+
+        // the defaults are those of an RN2483 with a 64 byte erase row and write latch
+        static void getDefaultConfig(SimulatorConfig& config);
+        void setConfig(const SimulatorConfig& config) { this->config = config; }
+        const SimulatorConfig& getConfig() { return config; }
+
+        // the module starts the application if there is one, unless the bootloader mode is forced
+        // (the flash contents are kept, they are only erased when constructed)
+        void powerOn(bool isBootloaderModeForced = false);
+
+        // loads Intel HEX records (".hex" or the HexFileImage*.h format: anything before
+        // the ':' of a record and after its checksum is ignored) straight into the flash
+        bool loadHexFile(const char* path);
+
+        bool isInBootloaderMode() { return isBootloaderMode; }
+        bool hasApplication();
+
+        // the baud rate the client currently sends and receives at
+        void setLineBaudRate(uint32_t baudRate) { lineBaudRate = baudRate; }
+        uint32_t getLineBaudRate() { return lineBaudRate; }
+
+        // a byte written by the client at the given time, it arrives once the line has carried it
+        void receive(uint8_t b, uint64_t nowMicros);
+
+        // also drops a partial frame once the frame timeout has passed
+        void poll(uint64_t nowMicros);
+
+        // the time the next response byte will have arrived at the client, or UINT64_MAX if there is none
+        uint64_t getNextOutputMicros();
+
+        // copies the response bytes that have arrived at the client by the given time
+        size_t transmit(uint8_t* buffer, size_t size, uint64_t nowMicros);
+
+        const uint8_t* getProgramMemory() { return programMemory; }
+        const SimulatorStats& getStats() { return stats; }
+        void clearStats();
+    private:
+        SimulatorConfig config;
+        SimulatorStats stats;
+
+        uint8_t programMemory[SIM_PROGRAM_MEMORY_SIZE];
+        uint8_t userId[SIM_USER_ID_SIZE];
+        uint8_t configWords[SIM_CONFIG_SIZE];
+        uint8_t eeprom[SIM_EEPROM_SIZE];
+
+        bool isBootloaderMode;
+        uint32_t lineBaudRate;
+
+        uint8_t frame[SIM_HEADER_SIZE + SIM_MAX_PACKET_DATA];
+        size_t frameLength;
+        bool isFrameGarbled;
+
+        // the time the last received byte has completely arrived
+        uint64_t lineInMicros;
+
+        uint8_t output[SIM_OUTPUT_BUFFER_SIZE];
+        size_t outputHead;
+        size_t outputTail;
+        uint64_t outputStartMicros;
+
+        uint32_t receivedByteCount; // in bootloader mode, for the byte loss
+
+        // the most data a frame can carry, see SimulatorConfig::MaxPacketSize
+        size_t getMaxPacketData();
+
+        uint32_t getByteMicros() { return lineBaudRate ? (10000000UL + lineBaudRate - 1) / lineBaudRate : 0; }
+
+        uint8_t* getMemory(uint32_t address, size_t size);
+
+        void receiveBootloader(uint8_t b);
+        void receiveApplication(uint8_t b);
+        void executeCommand();
+        void respond(const uint8_t* data, size_t size, uint32_t latencyMicros);
+
+        uint8_t eraseFlash(uint32_t address, uint16_t rowCount, uint32_t& latencyMicros);
+        uint8_t writeFlash(uint32_t address, const uint8_t* data, uint16_t size, uint32_t& latencyMicros);
+
+        bool loadHexRecord(const char* record, uint32_t& extendedAddress);
+};
+
+#endif /* BOOTLOADER_SIMULATOR_H_ */
@@ -0,0 +1,506 @@
+/*
+ * FleetSession.cpp
+ *
+ * See FleetSession.h.
+ */
+
+#include "FleetSession.h"
+#include "Arduino.h"
+#include "RN2483Bootloader.h"
+#include "Utils.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+
+#define FLEET_DEFAULT_BAUD_RATE 38400
+#define FLEET_APPLICATION_BAUD_RATE 57600
+#define FLEET_ERASE_APPLICATION_MICROS 1000000 // the time the module takes to start the bootloader
+#define FLEET_RESPONSE_MARGIN_MICROS 500000
+#define FLEET_ERASE_ROW_MICROS 10000
+#define FLEET_SYNC_ATTEMPTS 3
+
+// tried in this order, above the default rate and up to the target rate, as Sodaq_RN2483Bootloader::negotiateBaudRate()
+static const uint32_t FleetBaudRates[] = { 57600, 115200, 230400, 460800, 921600 };
+
+static speed_t toSpeed(uint32_t baudRate)
+{
+    switch (baudRate) {
+        case 9600: return B9600;
+        case 19200: return B19200;
+        case 38400: return B38400;
+        case 57600: return B57600;
+        case 115200: return B115200;
+        case 230400: return B230400;
+        case 460800: return B460800;
+        case 921600: return B921600;
+        default: return B0;
+    }
+}
+
+FleetSession::FleetSession() :
+    image(0),
+    path(0),
+    fd(-1),
+    state(FleetFailed),
+    error(0),
+    baudRate(0),
+    targetBaudRate(0),
+    verifiedBaudRate(0),
+    baudRateIndex(0),
+    attempts(0),
+    isVersionInfoValid(false),
+    writeChunkSize(0),
+    rangeIndex(0),
+    pageIndex(0),
+    chunkPageCount(0),
+    writtenBytes(0),
+    commandCount(0),
+    txLength(0),
+    txOffset(0),
+    rxLength(0),
+    rxExpected(0),
+    deadlineMicros(UINT64_MAX),
+    startMicros(0),
+    endMicros(0)
+{
+}
+
+const char* FleetSession::getStateName(FleetState state)
+{
+    switch (state) {
+        case FleetEraseApplication: return "erase application";
+        case FleetSync: return "sync";
+        case FleetSwitchBaudRate: return "switch baud rate";
+        case FleetErase: return "erase";
+        case FleetWrite: return "write";
+        case FleetVerify: return "verify";
+        case FleetReset: return "reset";
+        case FleetDone: return "done";
+        case FleetFailed: return "failed";
+        default: return "?";
+    }
+}
+
+bool FleetSession::open(const char* path, const FleetImage& image, uint32_t baudRate, bool isStartingInApplication, uint64_t nowMicros)
+{
+    this->image = &image;
+    this->path = path;
+    this->targetBaudRate = baudRate;
+    this->startMicros = nowMicros;
+
+    fd = ::open(path, O_RDWR | O_NOCTTY | O_NONBLOCK);
+
+    if (fd < 0) {
+        finish(FleetFailed, strerror(errno), nowMicros);
+        return false;
+    }
+
+    struct termios tty;
+
+    if (tcgetattr(fd, &tty) != 0) {
+        finish(FleetFailed, "not a serial port", nowMicros);
+        return false;
+    }
+
+    cfmakeraw(&tty);
+    tty.c_cflag |= CLOCAL | CREAD;
+    tty.c_cflag &= ~(CSTOPB | CRTSCTS);
+    tcsetattr(fd, TCSANOW, &tty);
+
+    if (!setBaudRate(isStartingInApplication ? FLEET_APPLICATION_BAUD_RATE : FLEET_DEFAULT_BAUD_RATE)) {
+        finish(FleetFailed, "unsupported baud rate", nowMicros);
+        return false;
+    }
+
+    state = isStartingInApplication ? FleetEraseApplication : FleetSync;
+    attempts = 0;
+    verifiedBaudRate = FLEET_DEFAULT_BAUD_RATE;
+    baudRateIndex = 0;
+    isVersionInfoValid = false;
+    next(nowMicros);
+
+    return true;
+}
+
+void FleetSession::close()
+{
+    if (fd >= 0) {
+        ::close(fd);
+        fd = -1;
+    }
+}
+
+bool FleetSession::setBaudRate(uint32_t baudRate)
+{
+    struct termios tty;
+    speed_t speed = toSpeed(baudRate);
+
+    if (speed == B0 || tcgetattr(fd, &tty) != 0) {
+        return false;
+    }
+
+    cfsetispeed(&tty, speed);
+    cfsetospeed(&tty, speed);
+
+    // nothing is in flight when the rate changes, anything received before is garbage
+    if (tcsetattr(fd, TCSANOW, &tty) != 0) {
+        return false;
+    }
+
+    tcflush(fd, TCIFLUSH);
+    this->baudRate = baudRate;
+
+    return true;
+}
+
+bool FleetSession::switchToNextBaudRate()
+{
+    while (baudRateIndex < ARRAY_SIZE(FleetBaudRates)) {
+        uint32_t nextBaudRate = FleetBaudRates[baudRateIndex++];
+
+        if (nextBaudRate > baudRate && nextBaudRate <= targetBaudRate && setBaudRate(nextBaudRate)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+uint8_t FleetSession::getProgressPercent()
+{
+    if (!image || state < FleetErase) {
+        return 0;
+    }
+
+    if (state >= FleetReset) {
+        return 100;
+    }
+
+    // every command of the erase, write and verify steps counts the same
+    size_t rangeCount = image->Plan.getRangeCount();
+    size_t total = 2 * rangeCount + image->PageCount;
+    size_t done = (state == FleetErase) ? rangeIndex : rangeCount + pageIndex;
+
+    if (state == FleetVerify) {
+        done = rangeCount + image->PageCount + rangeIndex;
+    }
+
+    return done * 100 / total;
+}
+
+void FleetSession::finish(FleetState state, const char* error, uint64_t nowMicros)
+{
+    this->state = state;
+    this->error = error;
+    this->endMicros = nowMicros;
+    this->deadlineMicros = UINT64_MAX;
+    this->txLength = 0;
+    this->txOffset = 0;
+}
+
+void FleetSession::sendText(const char* text, uint64_t nowMicros, uint32_t waitMicros)
+{
+    txLength = strlen(text);
+    txOffset = 0;
+    memcpy(tx, text, txLength);
+
+    rxLength = 0;
+    rxExpected = 0;
+    deadlineMicros = nowMicros + waitMicros;
+
+    onWritable(nowMicros);
+}
+
+void FleetSession::sendCommand(uint8_t command, uint16_t length, uint32_t address, const uint8_t* data, uint64_t nowMicros,
+                               uint32_t busyMicros)
+{
+    txLength = Sodaq_RN2483Bootloader::encodeCommand(tx, command, length, address);
+    txOffset = 0;
+
+    if (data) {
+        memcpy(&tx[txLength], data, length);
+        txLength += length;
+    }
+
+    // the module resets without responding, anything else echoes the header first
+    rxLength = 0;
+    rxExpected = (command == ResetDeviceCommand) ? 0
+                 : sizeof(BootloaderRecord) + Sodaq_RN2483Bootloader::getResponseDataLength(command, length);
+
+    uint64_t lineMicros = (uint64_t)(txLength + rxExpected) * 10 * 1000000 / baudRate;
+    deadlineMicros = nowMicros + lineMicros + busyMicros + FLEET_RESPONSE_MARGIN_MICROS;
+    commandCount++;
+
+    onWritable(nowMicros);
+}
+
+void FleetSession::onWritable(uint64_t nowMicros)
+{
+    while (txOffset < txLength) {
+        ssize_t n = write(fd, &tx[txOffset], txLength - txOffset);
+
+        if (n > 0) {
+            txOffset += n;
+        }
+        else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return; // the event loop calls again once the port is writable
+        }
+        else {
+            finish(FleetFailed, "write error", nowMicros);
+            return;
+        }
+    }
+
+    if (state == FleetReset) {
+        onResponse(nowMicros);
+    }
+}
+
+void FleetSession::onReadable(uint64_t nowMicros)
+{
+    uint8_t buffer[256];
+    ssize_t n;
+
+    while ((n = read(fd, buffer, sizeof(buffer))) > 0) {
+        // anything beyond the expected response is garbage
+        size_t count = min((size_t)n, rxExpected - rxLength);
+
+        memcpy(&rx[rxLength], buffer, count);
+        rxLength += count;
+    }
+
+    // the port has been hung up (e.g. the adapter has been unplugged), it would be readable again and again
+    if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+        finish(FleetFailed, "read error", nowMicros);
+        return;
+    }
+
+    if (rxExpected > 0 && rxLength == rxExpected && txOffset == txLength) {
+        onResponse(nowMicros);
+    }
+}
+
+void FleetSession::onHangUp(uint64_t nowMicros)
+{
+    if (!isFinished()) {
+        finish(FleetFailed, "port hung up", nowMicros);
+    }
+}
+
+void FleetSession::onTime(uint64_t nowMicros)
+{
+    if (isFinished() || nowMicros < deadlineMicros) {
+        return;
+    }
+
+    switch (state) {
+        case FleetEraseApplication:
+            setBaudRate(FLEET_DEFAULT_BAUD_RATE);
+            state = FleetSync;
+            break;
+
+        case FleetSync:
+            if (++attempts >= FLEET_SYNC_ATTEMPTS) {
+                if (baudRate == FLEET_DEFAULT_BAUD_RATE) {
+                    finish(FleetFailed, "the bootloader does not respond", nowMicros);
+                    return;
+                }
+
+                // it doesn't respond at the rate fallen back to either, so start over at the default rate
+                setBaudRate(FLEET_DEFAULT_BAUD_RATE);
+                verifiedBaudRate = FLEET_DEFAULT_BAUD_RATE;
+                attempts = 0;
+            }
+
+            tcflush(fd, TCIOFLUSH);
+            break;
+
+        case FleetSwitchBaudRate:
+            // the module doesn't keep up, so fall back to the last rate it responded at and sync again
+            // before going on: by now the module has also given up on the garbled frame
+            setBaudRate(verifiedBaudRate);
+            baudRateIndex = ARRAY_SIZE(FleetBaudRates);
+            attempts = 0;
+            state = FleetSync;
+            break;
+
+        default:
+            finish(FleetFailed, "response timeout", nowMicros);
+            return;
+    }
+
+    next(nowMicros);
+}
+
+void FleetSession::onResponse(uint64_t nowMicros)
+{
+    // the header is echoed
+    if (rxExpected > 0 && (rx[1] != tx[1] || memcmp(&rx[6], &tx[6], 4) != 0)) {
+        // while synchronizing it is handled as no response at all
+        if (state == FleetSync || state == FleetSwitchBaudRate) {
+            deadlineMicros = nowMicros;
+            onTime(nowMicros);
+        }
+        else {
+            finish(FleetFailed, "invalid response", nowMicros);
+        }
+
+        return;
+    }
+
+    const uint8_t* data = &rx[sizeof(BootloaderRecord)];
+    const EraseRange* range = (rangeIndex < image->Plan.getRangeCount()) ? &image->Plan.getRange(rangeIndex) : 0;
+
+    switch (state) {
+        case FleetSync:
+            if (!isVersionInfoValid) {
+                BootloaderVersionInfo info;
+                memcpy(&info, data, sizeof(info));
+
+                if (info.EraseRowSize != FLEET_PAGE_SIZE || info.WriteLatchSize == 0
+                        || info.EraseRowSize % info.WriteLatchSize != 0) {
+                    finish(FleetFailed, "unsupported flash geometry", nowMicros);
+                    return;
+                }
+
+                writeChunkSize = Sodaq_RN2483Bootloader::getMaxWriteSize(info, FLEET_MAX_WRITE_SIZE);
+                memcpy(versionInfo, data, sizeof(versionInfo));
+                isVersionInfoValid = true;
+            }
+            else if (memcmp(data, versionInfo, sizeof(versionInfo)) != 0) {
+                // after falling back, garbage can still make up a response
+                deadlineMicros = nowMicros;
+                onTime(nowMicros);
+                return;
+            }
+
+            verifiedBaudRate = baudRate;
+            state = switchToNextBaudRate() ? FleetSwitchBaudRate : FleetErase;
+            break;
+
+        case FleetSwitchBaudRate:
+            // garbage can still make up a response, so it has to match what was received at the default rate
+            if (memcmp(data, versionInfo, sizeof(versionInfo)) != 0) {
+                deadlineMicros = nowMicros;
+                onTime(nowMicros);
+                return;
+            }
+
+            verifiedBaudRate = baudRate;
+            state = switchToNextBaudRate() ? FleetSwitchBaudRate : FleetErase;
+            break;
+
+        case FleetErase:
+            if (data[0] != 1) {
+                finish(FleetFailed, "erase failed", nowMicros);
+                return;
+            }
+
+            rangeIndex++;
+            break;
+
+        case FleetWrite:
+            if (data[0] != 1) {
+                finish(FleetFailed, "write failed", nowMicros);
+                return;
+            }
+
+            writtenBytes += chunkPageCount * FLEET_PAGE_SIZE;
+            pageIndex += chunkPageCount;
+            break;
+
+        case FleetVerify:
+            if (!range || (data[0] | (data[1] << 8)) != range->Checksum) {
+                finish(FleetFailed, "verification failed", nowMicros);
+                return;
+            }
+
+            rangeIndex++;
+            break;
+
+        case FleetReset:
+            finish(FleetDone, 0, nowMicros);
+            return;
+
+        default:
+            break;
+    }
+
+    next(nowMicros);
+}
+
+void FleetSession::next(uint64_t nowMicros)
+{
+    const ErasePlan& plan = image->Plan;
+
+    switch (state) {
+        case FleetEraseApplication:
+            sendText("sys eraseFW\r\n", nowMicros, FLEET_ERASE_APPLICATION_MICROS);
+            return;
+
+        case FleetSync:
+        case FleetSwitchBaudRate:
+            sendCommand(GetVersionInfoCommand, 0, 0, 0, nowMicros);
+            return;
+
+        case FleetErase:
+            if (rangeIndex < plan.getRangeCount()) {
+                const EraseRange& range = plan.getRange(rangeIndex);
+
+                sendCommand(EraseFlashCommand, range.RowCount, range.Address, 0, nowMicros,
+                            range.RowCount * FLEET_ERASE_ROW_MICROS);
+                return;
+            }
+
+            state = FleetWrite;
+            pageIndex = 0;
+
+            // fall through
+        case FleetWrite:
+            if (pageIndex < image->PageCount) {
+                // adjacent pages are written as one chunk, straight from the image
+                chunkPageCount = 1;
+
+                while (pageIndex + chunkPageCount < image->PageCount
+                        && (chunkPageCount + 1) * FLEET_PAGE_SIZE <= writeChunkSize
+                        && image->PageAddresses[pageIndex + chunkPageCount]
+                           == image->PageAddresses[pageIndex] + chunkPageCount * FLEET_PAGE_SIZE) {
+                    chunkPageCount++;
+                }
+
+                sendCommand(WriteFlashCommand, chunkPageCount * FLEET_PAGE_SIZE, image->PageAddresses[pageIndex],
+                            &image->Data[pageIndex * FLEET_PAGE_SIZE], nowMicros);
+                return;
+            }
+
+            state = FleetVerify;
+            rangeIndex = 0;
+
+            // fall through
+        case FleetVerify:
+            // the user ID and configuration words can't be read back
+            while (rangeIndex < plan.getRangeCount() && plan.getRange(rangeIndex).Address >= RN2483_BOOTLOADER_PROGRAM_MEMORY_END) {
+                rangeIndex++;
+            }
+
+            if (rangeIndex < plan.getRangeCount()) {
+                const EraseRange& range = plan.getRange(rangeIndex);
+
+                sendCommand(CalculateChecksumCommand, range.RowCount * FLEET_PAGE_SIZE, range.Address, 0, nowMicros);
+                return;
+            }
+
+            state = FleetReset;
+
+            // fall through
+        case FleetReset:
+            sendCommand(ResetDeviceCommand, 0, 0, 0, nowMicros);
+            return;
+
+        default:
+            return;
+    }
+}
@@ -0,0 +1,126 @@
+/*
+ * FleetSession.h
+ *
+ * One module of a fleet update (see fleet_flash.cpp): a state machine that
+ * drives a serial port without ever blocking, so that any number of them can
+ * share one event loop. It uses the framing of Sodaq_RN2483Bootloader and
+ * the same steps as the sketch: erase the planned ranges, write the pages
+ * coalesced into chunks, verify the ranges by checksum, and reset.
+ *
+ * All sessions share one FleetImage, which is parsed only once.
+ */
+
+#ifndef FLEET_SESSION_H_
+#define FLEET_SESSION_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "ErasePlan.h"
+
+#define FLEET_PAGE_SIZE 64 // the erase row size of the modules
+#define FLEET_MAX_PAGES (0x10000 / FLEET_PAGE_SIZE + 2)
+#define FLEET_MAX_WRITE_SIZE 256
+#define FLEET_MAX_ERASE_ROWS 64
+
+// the pages of the image, in the order of the image; pages with adjacent addresses
+// are also adjacent in Data, so that a chunk of them can be written straight from it
+struct FleetImage {
+    uint32_t PageAddresses[FLEET_MAX_PAGES];
+    uint8_t Data[FLEET_MAX_PAGES * FLEET_PAGE_SIZE];
+    size_t PageCount;
+
+    ErasePlan Plan;
+};
+
+enum FleetState {
+    FleetEraseApplication,
+    FleetSync,
+    FleetSwitchBaudRate,
+    FleetErase,
+    FleetWrite,
+    FleetVerify,
+    FleetReset,
+    FleetDone,
+    FleetFailed
+};
+
+class FleetSession
+{
+    public:
+        FleetSession();
+
+        // opens the port, starting in the application (sys eraseFW first) or in the bootloader
+        bool open(const char* path, const FleetImage& image, uint32_t baudRate, bool isStartingInApplication, uint64_t nowMicros);
+        void close();
+
+        int getFd() { return fd; }
+        const char* getPath() { return path; }
+
+        // the events of the event loop: the port is readable or writable, it has been hung up (the session
+        // fails, see also onReadable()), or the time has passed
+        void onReadable(uint64_t nowMicros);
+        void onWritable(uint64_t nowMicros);
+        void onHangUp(uint64_t nowMicros);
+        void onTime(uint64_t nowMicros);
+
+        // the time the session has to be woken up (see onTime()), and whether it waits to write
+        uint64_t getDeadlineMicros() { return deadlineMicros; }
+        bool isWaitingToWrite() { return txOffset < txLength; }
+
+        FleetState getState() { return state; }
+        static const char* getStateName(FleetState state);
+        bool isFinished() { return state == FleetDone || state == FleetFailed; }
+        const char* getError() { return error; }
+
+        uint32_t getBaudRate() { return baudRate; }
+        uint8_t getProgressPercent();
+        size_t getWrittenBytes() { return writtenBytes; }
+        uint32_t getCommandCount() { return commandCount; }
+        uint64_t getStartMicros() { return startMicros; }
+        uint64_t getEndMicros() { return endMicros; }
+    private:
+        const FleetImage* image;
+        const char* path;
+        int fd;
+
+        FleetState state;
+        const char* error;
+        uint32_t baudRate;
+        uint32_t targetBaudRate;
+        uint32_t verifiedBaudRate; // the highest rate the module has responded at
+        size_t baudRateIndex; // the next rate to try, see FleetBaudRates
+        uint8_t attempts;
+
+        bool isVersionInfoValid;
+        uint8_t versionInfo[16]; // as received at the default baud rate
+        size_t writeChunkSize;
+        size_t rangeIndex;
+        size_t pageIndex;
+        size_t chunkPageCount;
+        size_t writtenBytes;
+        uint32_t commandCount;
+
+        uint8_t tx[10 + FLEET_MAX_WRITE_SIZE];
+        size_t txLength;
+        size_t txOffset;
+
+        uint8_t rx[10 + 16];
+        size_t rxLength;
+        size_t rxExpected;
+
+        uint64_t deadlineMicros;
+        uint64_t startMicros;
+        uint64_t endMicros;
+
+        bool setBaudRate(uint32_t baudRate);
+        bool switchToNextBaudRate();
+        void sendText(const char* text, uint64_t nowMicros, uint32_t waitMicros);
+        void sendCommand(uint8_t command, uint16_t length, uint32_t address, const uint8_t* data, uint64_t nowMicros,
+                         uint32_t busyMicros = 0);
+        void onResponse(uint64_t nowMicros);
+        void next(uint64_t nowMicros);
+        void finish(FleetState state, const char* error, uint64_t nowMicros);
+};
+
+#endif /* FLEET_SESSION_H_ */
@@ -0,0 +1,198 @@
+/*
+ * async_test.cpp
+ *
+ * Drives Sodaq_RN2483AsyncBootloader against an in-process
+ * BootloaderSimulator, on the virtual clock of the host stand-in, through
+ * the completions a caller has to handle: a version probe, an erase, a
+ * write and the checksum of what was written, an error status, a command
+ * the module never responds to (a frame larger than the packet size it
+ * reports) and a response whose echoed header has been corrupted on the
+ * line.
+ *
+ * Prints one line per case and exits with 1 if any of them failed.
+ */
+
+#include "Arduino.h"
+#include "RN2483Bootloader.h"
+#include "RN2483AsyncBootloader.h"
+#include "BootloaderSimulator.h"
+
+#include <stdio.h>
+
+#define TEST_ADDRESS 0x1000
+#define TEST_ROW_SIZE 64
+#define TEST_MAX_PACKET_SIZE (SIM_HEADER_SIZE + TEST_ROW_SIZE)
+
+// passes the simulated time to the simulator, and can corrupt the address echoed by the next response
+class SimulatedModule : public HostSerialDevice
+{
+    public:
+        SimulatedModule(BootloaderSimulator& simulator) : simulator(simulator), isCorruptingEcho(false), responseOffset(0) { }
+
+        void corruptNextEcho() { isCorruptingEcho = true; responseOffset = 0; }
+
+        void setBaudRate(uint32_t baudRate) { simulator.setLineBaudRate(baudRate); }
+
+        void receive(const uint8_t* buffer, size_t size)
+        {
+            for (size_t i = 0; i < size; i++) {
+                simulator.receive(buffer[i], micros());
+            }
+        }
+
+        size_t transmit(uint8_t* buffer, size_t size)
+        {
+            simulator.poll(micros());
+
+            size_t count = simulator.transmit(buffer, size, micros());
+
+            for (size_t i = 0; i < count && isCorruptingEcho; i++, responseOffset++) {
+                // the first byte of the echoed address
+                if (responseOffset == 6) {
+                    buffer[i] ^= 0x01;
+                    isCorruptingEcho = false;
+                }
+            }
+
+            return count;
+        }
+    private:
+        BootloaderSimulator& simulator;
+        bool isCorruptingEcho;
+        size_t responseOffset;
+};
+
+static Sodaq_RN2483AsyncBootloader asyncBootloader;
+
+static bool isCompleted;
+static uint8_t completedCommand;
+static BootloaderCommandResult completedResult;
+static uint8_t completedData[RN2483_ASYNC_BOOTLOADER_RX_BUFFER_SIZE];
+static size_t completedSize;
+
+static int failureCount = 0;
+
+static const char* ResultNames[] = { "succeeded", "failed", "timed out", "invalid response" };
+
+static void onCompletion(uint8_t command, BootloaderCommandResult result, const uint8_t* data, size_t size)
+{
+    isCompleted = true;
+    completedCommand = command;
+    completedResult = result;
+    completedSize = size;
+    memcpy(completedData, data, size);
+}
+
+// polls from the main loop until the submitted command has completed, returns false if it could not be submitted
+static bool complete(bool isSubmitted)
+{
+    isCompleted = false;
+
+    if (!isSubmitted) {
+        return false;
+    }
+
+    while (!isCompleted) {
+        asyncBootloader.poll();
+        yield();
+    }
+
+    return true;
+}
+
+static void check(const char* name, bool isDone, uint8_t command, BootloaderCommandResult expectedResult,
+                  bool isDataCorrect = true)
+{
+    bool isPassed = isDone && (completedCommand == command) && (completedResult == expectedResult) && isDataCorrect;
+
+    printf("%-16s %s (%s)\n", name, isPassed ? "PASS" : "FAIL", isDone ? ResultNames[completedResult] : "not submitted");
+
+    if (!isPassed) {
+        failureCount++;
+    }
+}
+
+// the bootloader gives up on a partial frame after its frame timeout
+static void waitForIdleLine()
+{
+    delay(200);
+
+    while (Serial1.available() > 0) {
+        Serial1.read();
+    }
+}
+
+int main()
+{
+    BootloaderSimulator* simulator = new BootloaderSimulator();
+    SimulatedModule module(*simulator);
+    SimulatorConfig config = simulator->getConfig();
+
+    config.MaxPacketSize = TEST_MAX_PACKET_SIZE;
+    simulator->setConfig(config);
+    simulator->powerOn(true);
+
+    setVirtualClock(true);
+    Serial1.attach(&module);
+    Serial1.begin(38400);
+
+    asyncBootloader.init(Serial1);
+    asyncBootloader.setCompletionCallback(onCompletion);
+
+    // a version probe, as the updater starts with
+    bool isDone = complete(asyncBootloader.submitGetVersionInfo());
+    BootloaderVersionInfo versionInfo;
+    memcpy(&versionInfo, completedData, sizeof(versionInfo));
+
+    check("version info", isDone, GetVersionInfoCommand, BootloaderCommandSucceeded,
+          (completedSize == sizeof(versionInfo)) && (versionInfo.EraseRowSize == TEST_ROW_SIZE)
+          && (versionInfo.MaxPacketSize == TEST_MAX_PACKET_SIZE));
+
+    isDone = complete(asyncBootloader.submitEraseFlash(TEST_ADDRESS, 1));
+    check("erase", isDone, EraseFlashCommand, BootloaderCommandSucceeded);
+
+    uint8_t row[TEST_ROW_SIZE];
+
+    for (size_t i = 0; i < sizeof(row); i++) {
+        row[i] = (uint8_t)(i * 7 + 3);
+    }
+
+    isDone = complete(asyncBootloader.submitWriteFlash(TEST_ADDRESS, row, sizeof(row)));
+    check("write", isDone, WriteFlashCommand, BootloaderCommandSucceeded);
+
+    isDone = complete(asyncBootloader.submitGetChecksum(TEST_ADDRESS, sizeof(row)));
+    uint16_t checksum = completedData[0] | (completedData[1] << 8);
+
+    check("checksum", isDone, CalculateChecksumCommand, BootloaderCommandSucceeded,
+          (completedSize == 2) && (checksum == Sodaq_RN2483Bootloader::calculateChecksum(row, sizeof(row))));
+
+    // the bootloader itself can't be erased
+    isDone = complete(asyncBootloader.submitEraseFlash(0, 1));
+    check("error status", isDone, EraseFlashCommand, BootloaderCommandFailed);
+
+    // the module drops a frame that doesn't fit its packet, without responding
+    uint8_t rows[2 * TEST_ROW_SIZE];
+    memset(rows, 0, sizeof(rows));
+
+    isDone = complete(asyncBootloader.submitWriteFlash(TEST_ADDRESS, rows, sizeof(rows)));
+    check("timeout", isDone, WriteFlashCommand, BootloaderCommandTimedOut);
+
+    waitForIdleLine();
+
+    module.corruptNextEcho();
+    isDone = complete(asyncBootloader.submitGetChecksum(TEST_ADDRESS, sizeof(row)));
+    check("corrupted echo", isDone, CalculateChecksumCommand, BootloaderCommandInvalidResponse);
+
+    // and it responds as before after both
+    waitForIdleLine();
+
+    isDone = complete(asyncBootloader.submitGetVersionInfo());
+    check("recovered", isDone, GetVersionInfoCommand, BootloaderCommandSucceeded,
+          memcmp(completedData, &versionInfo, sizeof(versionInfo)) == 0);
+
+    Serial1.attach(0);
+    setVirtualClock(false);
+    delete simulator;
+
+    return (failureCount == 0) ? 0 : 1;
+}
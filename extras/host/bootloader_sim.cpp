@@ -0,0 +1,222 @@
+/*
+ * bootloader_sim.cpp
+ *
+ * Exposes a BootloaderSimulator on a pty, so that the unmodified updater
+ * (see updater_host.cpp) can be run against it end to end:
+ *
+ *   build/bootloader_sim -l /tmp/rn2483 &
+ *   build/updater_RN2483_105 /tmp/rn2483
+ *
+ * The baud rate the client configured on its side of the pty is used for the
+ * serial timing model, as the pty itself doesn't pace anything.
+ *
+ * Options:
+ *   -l <path>    also make the pty available as a symlink at the given path
+ *   -i <image>   preload the flash (.hex or HexFileImage*.h), otherwise there
+ *                is no application and the module starts in the bootloader
+ *   -B           start in the bootloader, even with an application
+ *   -a <banner>  the "sys reset" response of the application
+ *   -m <baud>    the highest baud rate the autobaud still recognizes
+ *   -p <size>    the maximum packet size reported in the version info (default: none,
+ *                so frames are limited to one erase row)
+ *   -e <n>       lose every nth byte received in the bootloader (to exercise
+ *                the recovery of the updater)
+ *   -v           log the mode changes and commands to stderr
+ */
+
+#include "BootloaderSimulator.h"
+
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+static volatile bool isRunning = true;
+
+static void onSignal(int)
+{
+    isRunning = false;
+}
+
+static uint64_t monotonicMicros()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+static uint32_t toBaudRate(speed_t speed)
+{
+    switch (speed) {
+        case B9600: return 9600;
+        case B19200: return 19200;
+        case B38400: return 38400;
+        case B57600: return 57600;
+        case B115200: return 115200;
+        case B230400: return 230400;
+        case B460800: return 460800;
+        case B921600: return 921600;
+        default: return 0;
+    }
+}
+
+static void printStats(BootloaderSimulator& simulator)
+{
+    const SimulatorStats& stats = simulator.getStats();
+
+    fprintf(stderr, "frames: %u (%u dropped), erased rows: %u, written latches: %u, bytes in/out: %u/%u, lost bytes: %u\n",
+            stats.FrameCount, stats.DroppedFrameCount, stats.ErasedRowCount, stats.WrittenLatchCount,
+            stats.BytesReceived, stats.BytesSent, stats.LostByteCount);
+}
+
+int main(int argc, char** argv)
+{
+    static BootloaderSimulator simulator;
+    SimulatorConfig config = simulator.getConfig();
+
+    const char* linkPath = 0;
+    const char* imagePath = 0;
+    bool isBootloaderModeForced = false;
+    bool isVerbose = false;
+    int option;
+
+    while ((option = getopt(argc, argv, "l:i:Ba:m:p:e:v")) != -1) {
+        switch (option) {
+            case 'l': linkPath = optarg; break;
+            case 'i': imagePath = optarg; break;
+            case 'B': isBootloaderModeForced = true; break;
+            case 'a': snprintf(config.ApplicationBanner, sizeof(config.ApplicationBanner), "%s", optarg); break;
+            case 'm': config.MaxBaudRate = strtoul(optarg, 0, 10); break;
+            case 'p': config.MaxPacketSize = strtoul(optarg, 0, 10); break;
+            case 'e': config.ByteLossInterval = strtoul(optarg, 0, 10); break;
+            case 'v': isVerbose = true; break;
+            default:
+                fprintf(stderr, "Usage: %s [-l link] [-i image] [-B] [-a banner] [-m max baud] [-p max packet size] [-e loss interval] [-v]\n", argv[0]);
+                return 2;
+        }
+    }
+
+    simulator.setConfig(config);
+
+    if (imagePath && !simulator.loadHexFile(imagePath)) {
+        return 1;
+    }
+
+    int master = posix_openpt(O_RDWR | O_NOCTTY);
+
+    if (master < 0 || grantpt(master) != 0 || unlockpt(master) != 0) {
+        perror("posix_openpt");
+        return 1;
+    }
+
+    const char* slavePath = ptsname(master);
+
+    // the slave side stays open, so that the master doesn't fail while no client has it open
+    int slave = open(slavePath, O_RDWR | O_NOCTTY);
+    struct termios tty;
+
+    if (slave < 0 || tcgetattr(slave, &tty) != 0) {
+        perror(slavePath);
+        return 1;
+    }
+
+    cfmakeraw(&tty);
+    tcsetattr(slave, TCSANOW, &tty);
+    fcntl(master, F_SETFL, fcntl(master, F_GETFL) | O_NONBLOCK);
+
+    if (linkPath) {
+        unlink(linkPath);
+
+        if (symlink(slavePath, linkPath) != 0) {
+            perror(linkPath);
+            return 1;
+        }
+    }
+
+    signal(SIGINT, onSignal);
+    signal(SIGTERM, onSignal);
+
+    simulator.powerOn(isBootloaderModeForced);
+
+    printf("%s\n", linkPath ? linkPath : slavePath);
+    fflush(stdout);
+
+    bool wasInBootloaderMode = !simulator.isInBootloaderMode();
+    SimulatorStats lastStats = simulator.getStats();
+
+    while (isRunning) {
+        uint64_t now = monotonicMicros();
+
+        if (tcgetattr(master, &tty) == 0) {
+            simulator.setLineBaudRate(toBaudRate(cfgetospeed(&tty)));
+        }
+
+        simulator.poll(now);
+
+        uint8_t buffer[256];
+        size_t count = simulator.transmit(buffer, sizeof(buffer), now);
+
+        if (count > 0 && write(master, buffer, count) != (ssize_t)count) {
+            perror("write");
+        }
+
+        if (isVerbose) {
+            if (wasInBootloaderMode != simulator.isInBootloaderMode()) {
+                wasInBootloaderMode = simulator.isInBootloaderMode();
+                fprintf(stderr, "[%s mode]\n", wasInBootloaderMode ? "bootloader" : "application");
+            }
+
+            const SimulatorStats& stats = simulator.getStats();
+
+            for (size_t i = 0; i < sizeof(stats.CommandCounts) / sizeof(stats.CommandCounts[0]); i++) {
+                if (stats.CommandCounts[i] != lastStats.CommandCounts[i]) {
+                    fprintf(stderr, "command 0x%02X at %u baud\n", (unsigned)i, simulator.getLineBaudRate());
+                }
+            }
+
+            lastStats = stats;
+        }
+
+        // wake up for the next response byte, or to check the frame timeout and the baud rate
+        uint64_t next = simulator.getNextOutputMicros();
+        int timeoutMS = 20;
+
+        if (next != UINT64_MAX) {
+            timeoutMS = next > now ? (int)((next - now + 999) / 1000) : 0;
+            timeoutMS = timeoutMS < 20 ? timeoutMS : 20;
+        }
+
+        struct pollfd pfd = { master, POLLIN, 0 };
+
+        if (poll(&pfd, 1, timeoutMS) > 0 && (pfd.revents & POLLIN)) {
+            ssize_t n = read(master, buffer, sizeof(buffer));
+            now = monotonicMicros();
+
+            // the client may just have changed the baud rate before writing
+            if (tcgetattr(master, &tty) == 0) {
+                simulator.setLineBaudRate(toBaudRate(cfgetospeed(&tty)));
+            }
+
+            for (ssize_t i = 0; i < n; i++) {
+                simulator.receive(buffer[i], now);
+            }
+        }
+    }
+
+    if (linkPath) {
+        unlink(linkPath);
+    }
+
+    printStats(simulator);
+
+    close(slave);
+    close(master);
+
+    return 0;
+}
@@ -0,0 +1,74 @@
+/*
+ * erase_bench.cpp
+ *
+ * Compares the number of EraseFlash commands of erasing every page when it is
+ * started with those of the erase plan (see ErasePlan.h), for the image
+ * selected at compile time (see HexFileImage.h).
+ *
+ * The round-trip estimate only counts the bytes on the wire: a 10 byte command
+ * and an 11 byte response at 38400 baud, 8N1. The erase time on the device is
+ * the same for both, as the same rows are erased.
+ *
+ * It also checks that the smaller ranges of an incremental plan still fit, and
+ * reports how many checksum commands comparing them with the device takes.
+ */
+
+#include "Arduino.h"
+#include "IntelHexParser.h"
+#include "ErasePlan.h"
+#include "HexFileImage.h"
+#include "Utils.h"
+
+#include <stdio.h>
+
+#define STR_HELPER(x) #x
+#define STR(x) STR_HELPER(x)
+
+static const size_t EraseRowSize = 64;
+static const uint8_t MaxEraseRows = 64;
+static const uint8_t IncrementalRegionRows = 16;
+static const double RoundTripMS = (10 + 11) * 10 * 1000.0 / 38400;
+
+static ErasePlan erasePlan;
+static size_t pageCount = 0;
+
+static bool planPage(uint32_t startingAddress, const uint8_t* buffer, size_t size)
+{
+    for (size_t offset = 0; offset < size; offset += EraseRowSize) {
+        erasePlan.addRow(startingAddress + offset, 0);
+    }
+
+    pageCount++;
+
+    return true;
+}
+
+int main()
+{
+    StaticIntelHexParser<EraseRowSize> parser;
+
+    erasePlan.clear(EraseRowSize, IncrementalRegionRows);
+
+    if (!parser.scanImage(planPage) || !erasePlan.isComplete()) {
+        printf("Incremental planning failed!\n");
+        return 1;
+    }
+
+    size_t regionCount = erasePlan.getRangeCount();
+
+    pageCount = 0;
+    erasePlan.clear(EraseRowSize, MaxEraseRows);
+
+    if (!parser.scanImage(planPage) || !erasePlan.isComplete()) {
+        printf("Planning failed!\n");
+        return 1;
+    }
+
+    printf("%-16s per page %4u erases (%7.1f ms), planned %2u erases (%5.1f ms) for %u rows, %2u incremental regions\n",
+           STR(HexFileImage),
+           (unsigned)pageCount, pageCount * RoundTripMS,
+           (unsigned)erasePlan.getRangeCount(), erasePlan.getRangeCount() * RoundTripMS,
+           (unsigned)erasePlan.getRowCount(), (unsigned)regionCount);
+
+    return 0;
+}
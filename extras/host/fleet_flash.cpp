@@ -0,0 +1,246 @@
+/*
+ * fleet_flash.cpp
+ *
+ * Updates any number of modules concurrently, from one epoll event loop, with
+ * the image selected at compile time (see HexFileImage.h). The image is
+ * parsed once and shared by all the sessions (see FleetSession.h).
+ *
+ *   build/fleet_flash_RN2483_105 [-b baud] [-a] /dev/ttyUSB0 /dev/ttyUSB1 ...
+ *
+ * Options:
+ *   -b <baud>    the highest baud rate to switch the bootloader to (default
+ *                230400); the rates in between are tried first, and a module
+ *                stays at the highest one it keeps up with
+ *   -a           the modules run their application, erase it first (sys eraseFW)
+ *   -q           don't print the progress every second, only the results
+ *
+ * The progress of every port is printed once a second, the result (and the
+ * throughput, in image bytes per second) of every port at the end. The exit
+ * code is 0 only if all the modules have been updated and verified.
+ */
+
+#include "Arduino.h"
+#include "IntelHexParser.h"
+#include "RN2483Bootloader.h"
+#include "HexFileImage.h"
+#include "Utils.h"
+#include "FleetSession.h"
+
+#include <stdio.h>
+#include <sys/epoll.h>
+#include <time.h>
+#include <unistd.h>
+
+#define STR_HELPER(x) #x
+#define STR(x) STR_HELPER(x)
+
+#define FLEET_MAX_PORTS 64
+#define FLEET_PROGRESS_INTERVAL_MICROS 1000000
+
+static FleetImage image;
+static FleetSession sessions[FLEET_MAX_PORTS];
+
+static uint64_t monotonicMicros()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+static bool addPage(uint32_t startingAddress, const uint8_t* buffer, size_t size)
+{
+    if (image.PageCount >= FLEET_MAX_PAGES) {
+        return false;
+    }
+
+    image.PageAddresses[image.PageCount] = startingAddress;
+    memcpy(&image.Data[image.PageCount * FLEET_PAGE_SIZE], buffer, size);
+    image.PageCount++;
+
+    return image.Plan.addRow(startingAddress, Sodaq_RN2483Bootloader::calculateChecksum(buffer, size));
+}
+
+static bool loadImage()
+{
+    static StaticIntelHexParser<FLEET_PAGE_SIZE> parser;
+
+    image.PageCount = 0;
+    image.Plan.clear(FLEET_PAGE_SIZE, FLEET_MAX_ERASE_ROWS);
+
+    parser.setPageCompleteCallback(addPage);
+
+    return parser.verifyImageIntegrity() && parser.parseImage() && image.Plan.isComplete();
+}
+
+static void printProgress(size_t sessionCount, uint64_t nowMicros, uint64_t startMicros)
+{
+    printf("[%6.1fs]", (nowMicros - startMicros) / 1000000.0);
+
+    for (size_t i = 0; i < sessionCount; i++) {
+        FleetSession& session = sessions[i];
+
+        if (session.isFinished()) {
+            printf(" %s: %s |", session.getPath(), FleetSession::getStateName(session.getState()));
+        }
+        else {
+            printf(" %s: %s %u%% |", session.getPath(), FleetSession::getStateName(session.getState()),
+                   (unsigned)session.getProgressPercent());
+        }
+    }
+
+    printf("\n");
+    fflush(stdout);
+}
+
+static void printResults(size_t sessionCount)
+{
+    printf("\n%-24s %-8s %9s %10s %9s %8s  %s\n", "port", "result", "time (s)", "bytes/s", "baud", "commands", "error");
+
+    for (size_t i = 0; i < sessionCount; i++) {
+        FleetSession& session = sessions[i];
+        double seconds = (session.getEndMicros() - session.getStartMicros()) / 1000000.0;
+
+        printf("%-24s %-8s %9.1f %10.0f %9u %8u  %s\n", session.getPath(), FleetSession::getStateName(session.getState()),
+               seconds, seconds > 0 ? session.getWrittenBytes() / seconds : 0.0, (unsigned)session.getBaudRate(),
+               (unsigned)session.getCommandCount(), session.getError() ? session.getError() : "");
+    }
+}
+
+int main(int argc, char** argv)
+{
+    uint32_t baudRate = 230400;
+    bool isStartingInApplication = false;
+    bool isQuiet = false;
+    int option;
+
+    while ((option = getopt(argc, argv, "b:aq")) != -1) {
+        switch (option) {
+            case 'b': baudRate = strtoul(optarg, 0, 10); break;
+            case 'a': isStartingInApplication = true; break;
+            case 'q': isQuiet = true; break;
+            default:
+                fprintf(stderr, "Usage: %s [-b baud] [-a] [-q] port...\n", argv[0]);
+                return 2;
+        }
+    }
+
+    size_t sessionCount = argc - optind;
+
+    if (sessionCount == 0 || sessionCount > FLEET_MAX_PORTS) {
+        fprintf(stderr, "Usage: %s [-b baud] [-a] [-q] port... (at most %u ports)\n", argv[0], FLEET_MAX_PORTS);
+        return 2;
+    }
+
+    if (!loadImage()) {
+        fprintf(stderr, "Loading the image failed!\n");
+        return 1;
+    }
+
+    printf("Image %s: %u pages, %u erase ranges, %u port(s) at %u baud\n", STR(HexFileImage), (unsigned)image.PageCount,
+           (unsigned)image.Plan.getRangeCount(), (unsigned)sessionCount, (unsigned)baudRate);
+
+    int epollFd = epoll_create1(0);
+    bool isWaitingToWrite[FLEET_MAX_PORTS] = { false };
+    uint64_t startMicros = monotonicMicros();
+
+    for (size_t i = 0; i < sessionCount; i++) {
+        if (!sessions[i].open(argv[optind + i], image, baudRate, isStartingInApplication, monotonicMicros())) {
+            continue;
+        }
+
+        struct epoll_event event;
+        event.events = EPOLLIN;
+        event.data.u32 = i;
+        epoll_ctl(epollFd, EPOLL_CTL_ADD, sessions[i].getFd(), &event);
+    }
+
+    uint64_t nextProgressMicros = startMicros + FLEET_PROGRESS_INTERVAL_MICROS;
+
+    while (true) {
+        uint64_t nowMicros = monotonicMicros();
+        uint64_t wakeUpMicros = nextProgressMicros;
+        size_t activeCount = 0;
+
+        for (size_t i = 0; i < sessionCount; i++) {
+            FleetSession& session = sessions[i];
+
+            if (session.isFinished()) {
+                if (session.getFd() >= 0) {
+                    epoll_ctl(epollFd, EPOLL_CTL_DEL, session.getFd(), 0);
+                    session.close();
+                }
+
+                continue;
+            }
+
+            activeCount++;
+            wakeUpMicros = min(wakeUpMicros, session.getDeadlineMicros());
+
+            // only wait for the port to be writable while there is something to write
+            if (session.isWaitingToWrite() != isWaitingToWrite[i]) {
+                struct epoll_event event;
+
+                isWaitingToWrite[i] = session.isWaitingToWrite();
+                event.events = EPOLLIN | (isWaitingToWrite[i] ? EPOLLOUT : 0);
+                event.data.u32 = i;
+                epoll_ctl(epollFd, EPOLL_CTL_MOD, session.getFd(), &event);
+            }
+        }
+
+        if (activeCount == 0) {
+            break;
+        }
+
+        struct epoll_event events[FLEET_MAX_PORTS];
+        int timeoutMS = wakeUpMicros > nowMicros ? (int)((wakeUpMicros - nowMicros + 999) / 1000) : 0;
+        int count = epoll_wait(epollFd, events, FLEET_MAX_PORTS, timeoutMS);
+
+        nowMicros = monotonicMicros();
+
+        for (int e = 0; e < count; e++) {
+            FleetSession& session = sessions[events[e].data.u32];
+
+            if (events[e].events & EPOLLOUT) {
+                session.onWritable(nowMicros);
+            }
+
+            if (events[e].events & (EPOLLIN | EPOLLERR | EPOLLHUP)) {
+                session.onReadable(nowMicros);
+            }
+
+            // the events are level triggered, so the port is taken out of the set before the next wait
+            if (events[e].events & (EPOLLERR | EPOLLHUP)) {
+                session.onHangUp(nowMicros);
+
+                if (session.getFd() >= 0) {
+                    epoll_ctl(epollFd, EPOLL_CTL_DEL, session.getFd(), 0);
+                    session.close();
+                }
+            }
+        }
+
+        for (size_t i = 0; i < sessionCount; i++) {
+            sessions[i].onTime(nowMicros);
+        }
+
+        if (nowMicros >= nextProgressMicros) {
+            if (!isQuiet) {
+                printProgress(sessionCount, nowMicros, startMicros);
+            }
+
+            nextProgressMicros = nowMicros + FLEET_PROGRESS_INTERVAL_MICROS;
+        }
+    }
+
+    close(epollFd);
+    printResults(sessionCount);
+
+    for (size_t i = 0; i < sessionCount; i++) {
+        if (sessions[i].getState() != FleetDone) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
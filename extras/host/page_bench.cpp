@@ -0,0 +1,121 @@
+/*
+ * page_bench.cpp
+ *
+ * Micro-benchmark of the page handling of IntelHexParser for the image
+ * selected at compile time (see HexFileImage.h):
+ *  - the enclosing page calculation, as the former trunc() based expression,
+ *    the integer modulo and the power of two mask, over every image address
+ *  - a full parsing pass of the runtime page size IntelHexParser versus the
+ *    StaticIntelHexParser<PageSize> template
+ *
+ * Note that the host has a hardware FPU, the trunc() variant is much more
+ * expensive on the soft-float Cortex-M0.
+ */
+
+#include "Arduino.h"
+#include "IntelHexParser.h"
+#include "HexFileImage.h"
+#include "Utils.h"
+
+#include <stdio.h>
+
+#define STR_HELPER(x) #x
+#define STR(x) STR_HELPER(x)
+
+static const size_t BenchPageSize = 64;
+static const uint8_t AlignmentRounds = 50;
+static const uint8_t ParsingPasses = 50;
+
+static uint32_t imageAddresses[0x20000];
+static size_t imageAddressCount = 0;
+
+static bool collectAddresses(uint32_t startingAddress, const uint8_t* buffer, size_t size)
+{
+    for (size_t i = 0; i < size; i++) {
+        if (imageAddressCount < ARRAY_SIZE(imageAddresses)) {
+            imageAddresses[imageAddressCount++] = startingAddress + i;
+        }
+    }
+
+    return true;
+}
+
+static void printResult(const char* name, uint32_t elapsedMicros, double operations)
+{
+    printf("%-16s %-30s %10.3f ms %8.2f ns/address\n",
+           STR(HexFileImage), name, elapsedMicros / 1000.0, elapsedMicros * 1000.0 / operations);
+}
+
+static void benchAlignment(volatile size_t pageSize)
+{
+    volatile uint32_t sink = 0;
+    const uint32_t pageAlignMask = ~(uint32_t)(pageSize - 1);
+    double operations = (double)imageAddressCount * AlignmentRounds;
+
+    uint32_t start = micros();
+
+    for (uint8_t round = 0; round < AlignmentRounds; round++) {
+        for (size_t i = 0; i < imageAddressCount; i++) {
+            sink = trunc(imageAddresses[i] / pageSize) * pageSize;
+        }
+    }
+
+    printResult("align trunc() (former)", micros() - start, operations);
+
+    start = micros();
+
+    for (uint8_t round = 0; round < AlignmentRounds; round++) {
+        for (size_t i = 0; i < imageAddressCount; i++) {
+            sink = imageAddresses[i] - (imageAddresses[i] % pageSize);
+        }
+    }
+
+    printResult("align modulo", micros() - start, operations);
+
+    start = micros();
+
+    for (uint8_t round = 0; round < AlignmentRounds; round++) {
+        for (size_t i = 0; i < imageAddressCount; i++) {
+            sink = imageAddresses[i] & pageAlignMask;
+        }
+    }
+
+    printResult("align mask", micros() - start, operations);
+
+    (void)sink;
+}
+
+static void benchParsing(IntelHexParser& parser, const char* name)
+{
+    uint32_t start = micros();
+
+    for (uint8_t i = 0; i < ParsingPasses; i++) {
+        if (!parser.parseImage()) {
+            printf("%s: parsing failed!\n", name);
+            exit(1);
+        }
+    }
+
+    printf("%-16s %-30s %10.3f ms/pass\n", STR(HexFileImage), name, (micros() - start) / 1000.0 / ParsingPasses);
+}
+
+int main()
+{
+    StaticIntelHexParser<BenchPageSize> staticParser;
+    IntelHexParser runtimeParser(BenchPageSize);
+
+    staticParser.setPageCompleteCallback(collectAddresses);
+
+    if (!staticParser.parseImage()) {
+        printf("Collecting the image addresses failed!\n");
+        return 1;
+    }
+
+    staticParser.setPageCompleteCallback(0);
+
+    benchAlignment(BenchPageSize);
+    benchParsing(runtimeParser, "parse IntelHexParser(64)");
+    benchParsing(staticParser, "parse StaticIntelHexParser<64>");
+
+    return 0;
+}
@@ -0,0 +1,116 @@
+/*
+ * parser_bench.cpp
+ *
+ * Host benchmark of the IntelHexParser decoding pass (parseImage() without
+ * any page callbacks) for the image selected at compile time (see HexFileImage.h).
+ *
+ * It compares the legacy behaviour (a delay(1) on every line) with the
+ * time-sliced yield, and reports lines/sec for both. It also prints a digest
+ * of the completed pages, which must be the same for the hex records and the
+ * packed version of an image.
+ */
+
+#include "Arduino.h"
+#include "IntelHexParser.h"
+#include "HexFileImage.h"
+#include "Utils.h"
+
+#include <stdio.h>
+
+#define STR_HELPER(x) #x
+#define STR(x) STR_HELPER(x)
+
+#ifdef HEXFILE_PACKED
+#define IMAGE_FORMAT "packed"
+#define IMAGE_UNITS "bytes"
+#define IMAGE_UNIT_COUNT (HexFileImage.DataSize)
+#else
+#define IMAGE_FORMAT "hex"
+#define IMAGE_UNITS "lines"
+#define IMAGE_UNIT_COUNT ARRAY_SIZE(HexFileImage)
+#endif
+
+static size_t yieldCount = 0;
+static size_t pageCount = 0;
+static uint32_t pageDigest = 0;
+
+static void legacyLineDelay()
+{
+    yieldCount++;
+    delay(1);
+}
+
+static void countingYield()
+{
+    yieldCount++;
+}
+
+// FNV-1a over the address and contents of every completed page
+static bool digestPage(uint32_t startingAddress, const uint8_t* buffer, size_t size)
+{
+    for (uint8_t i = 0; i < 4; i++) {
+        pageDigest = (pageDigest ^ (uint8_t)(startingAddress >> (i * 8))) * 16777619UL;
+    }
+
+    for (size_t i = 0; i < size; i++) {
+        pageDigest = (pageDigest ^ buffer[i]) * 16777619UL;
+    }
+
+    pageCount++;
+
+    return true;
+}
+
+static void runPass(const char* name, YieldCallback cb, uint32_t intervalMS, uint8_t passes)
+{
+    IntelHexParser parser(64);
+    parser.setYieldCallback(cb, intervalMS);
+
+    yieldCount = 0;
+    uint32_t start = micros();
+
+    for (uint8_t i = 0; i < passes; i++) {
+        if (!parser.parseImage()) {
+            printf("%s: parsing failed!\n", name);
+            exit(1);
+        }
+    }
+
+    uint32_t elapsed = micros() - start;
+    double units = (double)IMAGE_UNIT_COUNT * passes;
+
+    printf("%-16s %-6s %-12s %8u %-5s %10.3f ms/pass %12.0f %s/s %6u yields/pass\n",
+           STR(HexFileImage), IMAGE_FORMAT, name, (unsigned)IMAGE_UNIT_COUNT, IMAGE_UNITS,
+           elapsed / 1000.0 / passes, units * 1000000.0 / elapsed, IMAGE_UNITS, (unsigned)(yieldCount / passes));
+}
+
+static void printPageDigest()
+{
+    IntelHexParser parser(64);
+    parser.setPageCompleteCallback(digestPage);
+
+    pageDigest = 2166136261UL;
+    pageCount = 0;
+
+    if (!parser.verifyImageIntegrity() || !parser.parseImage()) {
+        printf("page digest: parsing failed!\n");
+        exit(1);
+    }
+
+    printf("%-16s %-6s pages        %8u       digest 0x%08X\n",
+           STR(HexFileImage), IMAGE_FORMAT, (unsigned)pageCount, (unsigned)pageDigest);
+}
+
+int main(int argc, char** argv)
+{
+    bool skipLegacy = (argc > 1) && (strcmp(argv[1], "--no-legacy") == 0);
+
+    if (!skipLegacy) {
+        runPass("legacy", legacyLineDelay, 0, 1);
+    }
+
+    runPass("time-sliced", countingYield, INTEL_HEX_PARSER_DEFAULT_YIELD_INTERVAL, 20);
+    printPageDigest();
+
+    return 0;
+}
@@ -0,0 +1,224 @@
+/*
+ * update_bench.cpp
+ *
+ * Runs complete updates of the image selected at compile time (see
+ * HexFileImage.h) against an in-process BootloaderSimulator, on the virtual
+ * clock of the host stand-in, over a matrix of:
+ *  - the bootloader baud rate (negotiated up from 38400)
+ *  - the write size (64 bytes is one latch per command, so no coalescing),
+ *    set through the maximum packet size the simulated module reports
+ *  - the erase strategy: one row per page, the erase plan, or the
+ *    incremental plan that skips the regions the module already holds
+ *
+ * Each run prints one CSV line (see printHeader()). The time is the update
+ * itself, from GetVersionInfo until the last write; the CPU time of the
+ * updater is not modeled. After each run the simulated flash is compared
+ * with the image ("ok" or "corrupt").
+ *
+ * Options:
+ *   -s <image>   the flash contents the module starts with (.hex or
+ *                HexFileImage*.h), it is blank otherwise (as after sys eraseFW)
+ *   -n           don't print the CSV header
+ */
+
+#include "Arduino.h"
+#include "IntelHexParser.h"
+#include "FlashProgrammer.h"
+#include "RN2483Bootloader.h"
+#include "HexFileImage.h"
+#include "Utils.h"
+#include "BootloaderSimulator.h"
+
+#include <stdio.h>
+#include <unistd.h>
+
+#define STR_HELPER(x) #x
+#define STR(x) STR_HELPER(x)
+
+enum EraseStrategy {
+    ErasePerPage,
+    ErasePlanned,
+    EraseIncremental
+};
+
+static const char* EraseStrategyNames[] = { "page", "plan", "incremental" };
+
+static const uint32_t BaudRates[] = { 38400, 115200, 230400 };
+static const uint16_t WriteSizes[] = { 64, 128, 256 };
+static const uint32_t DefaultBaudRate = 38400;
+
+// pass the simulated time to the simulator
+class SimulatedModule : public HostSerialDevice
+{
+    public:
+        SimulatedModule(BootloaderSimulator& simulator) : simulator(simulator) { }
+
+        void setBaudRate(uint32_t baudRate) { simulator.setLineBaudRate(baudRate); }
+
+        void receive(const uint8_t* buffer, size_t size)
+        {
+            for (size_t i = 0; i < size; i++) {
+                simulator.receive(buffer[i], micros());
+            }
+        }
+
+        size_t transmit(uint8_t* buffer, size_t size)
+        {
+            simulator.poll(micros());
+
+            return simulator.transmit(buffer, size, micros());
+        }
+    private:
+        BootloaderSimulator& simulator;
+};
+
+static StaticIntelHexParser<256> hexParser;
+static FlashProgrammer* programmer;
+
+static uint8_t expectedMemory[SIM_PROGRAM_MEMORY_SIZE];
+
+static bool onPageStart(uint32_t startingAddress)
+{
+    return programmer->startPage(startingAddress);
+}
+
+static bool onPageComplete(uint32_t startingAddress, const uint8_t* buffer, size_t size)
+{
+    return programmer->completePage(startingAddress, buffer, size);
+}
+
+static bool onPageScanned(uint32_t startingAddress, const uint8_t* buffer, size_t size)
+{
+    programmer->planPage(startingAddress, buffer, size);
+
+    return true;
+}
+
+static bool collectExpected(uint32_t startingAddress, const uint8_t* buffer, size_t size)
+{
+    if (startingAddress + size <= sizeof(expectedMemory)) {
+        memcpy(&expectedMemory[startingAddress], buffer, size);
+    }
+
+    return true;
+}
+
+static void printHeader()
+{
+    printf("image,baud,write_size,erase,result,time_ms,wire_bytes,commands,erase_commands,write_commands,checksum_commands,ack_wait_pct\n");
+}
+
+static bool runUpdate(const char* startImagePath, uint32_t baudRate, uint16_t writeSize, EraseStrategy strategy)
+{
+    BootloaderSimulator* simulator = new BootloaderSimulator();
+    SimulatedModule module(*simulator);
+    SimulatorConfig config = simulator->getConfig();
+
+    // the write size is only used when the module reports it as its maximum packet size
+    config.MaxPacketSize = writeSize + sizeof(BootloaderRecord);
+    simulator->setConfig(config);
+
+    if (startImagePath && !simulator->loadHexFile(startImagePath)) {
+        exit(1);
+    }
+
+    simulator->powerOn(true);
+
+    setVirtualClock(true);
+    Serial1.attach(&module);
+    Serial1.begin(DefaultBaudRate);
+
+    Sodaq_RN2483Bootloader bootloader;
+    FlashProgrammer flashProgrammer;
+    BootloaderVersionInfo versionInfo;
+
+    programmer = &flashProgrammer;
+    bootloader.initBootloader(Serial1);
+    flashProgrammer.init(bootloader, hexParser);
+
+    hexParser.setPageStartCallback(onPageStart);
+    hexParser.setPageCompleteCallback(onPageComplete);
+
+    bool isSuccessful = bootloader.getVersionInfo(versionInfo) && flashProgrammer.configureGeometry(versionInfo);
+
+    if (isSuccessful && baudRate != DefaultBaudRate) {
+        isSuccessful = bootloader.negotiateBaudRate(&baudRate, 1) == baudRate;
+    }
+
+    if (isSuccessful) {
+        flashProgrammer.beginErasePlan(strategy == EraseIncremental);
+
+        if (strategy != ErasePerPage) {
+            isSuccessful = hexParser.scanImage(onPageScanned)
+                           && ((strategy != EraseIncremental) || flashProgrammer.compareWithDevice())
+                           && flashProgrammer.executeErasePlan();
+        }
+    }
+
+    isSuccessful = isSuccessful && hexParser.parseImage() && flashProgrammer.finishPages();
+
+    uint32_t elapsedMicros = micros();
+    bool isFlashCorrect = memcmp(&simulator->getProgramMemory()[SIM_BOOTLOADER_END], &expectedMemory[SIM_BOOTLOADER_END],
+                                 sizeof(expectedMemory) - SIM_BOOTLOADER_END) == 0;
+
+    const SimulatorStats& stats = simulator->getStats();
+
+    printf("%s,%u,%u,%s,%s,%.1f,%u,%u,%u,%u,%u,%.1f\n",
+           STR(HexFileImage), (unsigned)baudRate, (unsigned)flashProgrammer.getWriteChunkSize(), EraseStrategyNames[strategy],
+           !isSuccessful ? "failed" : (isFlashCorrect ? "ok" : "corrupt"),
+           elapsedMicros / 1000.0, (unsigned)(stats.BytesReceived + stats.BytesSent), (unsigned)stats.FrameCount,
+           (unsigned)flashProgrammer.getEraseCommandCount(), (unsigned)flashProgrammer.getWriteCommandCount(),
+           (unsigned)flashProgrammer.getChecksumCommandCount(),
+           elapsedMicros ? stats.ResponseWaitMicros * 100.0 / elapsedMicros : 0.0);
+    fflush(stdout);
+
+    Serial1.attach(0);
+    setVirtualClock(false);
+    delete simulator;
+
+    return isSuccessful && isFlashCorrect;
+}
+
+int main(int argc, char** argv)
+{
+    const char* startImagePath = 0;
+    bool shouldPrintHeader = true;
+    int option;
+
+    while ((option = getopt(argc, argv, "s:n")) != -1) {
+        switch (option) {
+            case 's': startImagePath = optarg; break;
+            case 'n': shouldPrintHeader = false; break;
+            default:
+                fprintf(stderr, "Usage: %s [-s start image] [-n]\n", argv[0]);
+                return 2;
+        }
+    }
+
+    memset(expectedMemory, 0xFF, sizeof(expectedMemory));
+
+    // the pages have the size of an erase row, as with the programmer
+    hexParser.setPageSize(64);
+    hexParser.setPageCompleteCallback(collectExpected);
+
+    if (!hexParser.parseImage()) {
+        fprintf(stderr, "Parsing the image failed!\n");
+        return 1;
+    }
+
+    if (shouldPrintHeader) {
+        printHeader();
+    }
+
+    bool isSuccessful = true;
+
+    for (size_t b = 0; b < ARRAY_SIZE(BaudRates); b++) {
+        for (size_t w = 0; w < ARRAY_SIZE(WriteSizes); w++) {
+            for (uint8_t strategy = ErasePerPage; strategy <= EraseIncremental; strategy++) {
+                isSuccessful &= runUpdate(startImagePath, BaudRates[b], WriteSizes[w], (EraseStrategy)strategy);
+            }
+        }
+    }
+
+    return isSuccessful ? 0 : 1;
+}
@@ -0,0 +1,129 @@
+/*
+ * updater_host.cpp
+ *
+ * Runs the updater sketch on the host, with the module on the serial port given
+ * on the command line and the console on the terminal:
+ *
+ *   build/updater_RN2483_105 /dev/ttyUSB0 [checkpoint file]
+ *
+ * The console is switched to non-canonical mode, so that the single key
+ * presses the sketch waits for don't need an enter.
+ *
+ * The checkpoint of an update is kept in the given file, so that an update
+ * that was interrupted (even by killing the updater) can be resumed by the
+ * next run; without a file it is only kept while the updater runs.
+ */
+
+#include "Arduino.h"
+
+#include <limits.h>
+#include <stdio.h>
+#include <signal.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "../../RN2483FirmwareUpdater.ino"
+
+static const char* checkpointPath = 0;
+static UpdateCheckpoint memoryCheckpoint = { 0, 0 };
+
+bool loadCheckpoint(UpdateCheckpoint& checkpoint)
+{
+    if (!checkpointPath) {
+        checkpoint = memoryCheckpoint;
+        return true;
+    }
+
+    FILE* file = fopen(checkpointPath, "rb");
+
+    if (!file) {
+        return false;
+    }
+
+    bool isLoaded = fread(&checkpoint, sizeof(checkpoint), 1, file) == 1;
+    fclose(file);
+
+    return isLoaded;
+}
+
+// written to a temporary file first, so that the checkpoint is never half written
+void saveCheckpoint(const UpdateCheckpoint& checkpoint)
+{
+    if (!checkpointPath) {
+        memoryCheckpoint = checkpoint;
+        return;
+    }
+
+    char temporaryPath[PATH_MAX];
+    snprintf(temporaryPath, sizeof(temporaryPath), "%s.tmp", checkpointPath);
+
+    FILE* file = fopen(temporaryPath, "wb");
+
+    if (!file) {
+        return;
+    }
+
+    bool isWritten = fwrite(&checkpoint, sizeof(checkpoint), 1, file) == 1;
+
+    if (fclose(file) == 0 && isWritten) {
+        rename(temporaryPath, checkpointPath);
+    }
+}
+
+static struct termios consoleSettings;
+static bool isConsoleConfigured = false;
+
+static void restoreConsole()
+{
+    if (isConsoleConfigured) {
+        tcsetattr(STDIN_FILENO, TCSANOW, &consoleSettings);
+    }
+}
+
+static void onSignal(int signal)
+{
+    restoreConsole();
+    _exit(128 + signal);
+}
+
+static void configureConsole()
+{
+    if (!isatty(STDIN_FILENO) || tcgetattr(STDIN_FILENO, &consoleSettings) != 0) {
+        return;
+    }
+
+    struct termios settings = consoleSettings;
+    settings.c_lflag &= ~(ICANON | ECHO);
+    settings.c_cc[VMIN] = 0;
+    settings.c_cc[VTIME] = 0;
+
+    if (tcsetattr(STDIN_FILENO, TCSANOW, &settings) == 0) {
+        isConsoleConfigured = true;
+
+        atexit(restoreConsole);
+        signal(SIGINT, onSignal);
+        signal(SIGTERM, onSignal);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    if (argc != 2 && argc != 3) {
+        fprintf(stderr, "Usage: %s <serial device> [checkpoint file]\n", argv[0]);
+        return 2;
+    }
+
+    if (argc == 3) {
+        checkpointPath = argv[2];
+    }
+
+    Serial1.setDevice(argv[1]);
+
+    configureConsole();
+
+    setup();
+
+    while (true) {
+        loop();
+    }
+}
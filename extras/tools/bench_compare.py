@@ -0,0 +1,82 @@
+#!/usr/bin/env python3
+"""Compare the results of the update benchmark (extras/host/update_bench.cpp)
+with a stored baseline.
+
+Runs are matched on image, baud rate, write size and erase strategy. The
+command exits with 1 if a run doesn't end with "ok" anymore, is missing, or
+became slower than the baseline by more than the threshold.
+
+usage: bench_compare.py BASELINE CURRENT [-t PERCENT]
+"""
+
+import argparse
+import csv
+import os
+import sys
+
+KEY_COLUMNS = ("image", "baud", "write_size", "erase")
+
+
+def read_runs(path):
+    with open(path, newline="") as f:
+        return {tuple(row[c] for c in KEY_COLUMNS): row for row in csv.DictReader(f)}
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("baseline")
+    parser.add_argument("current")
+    parser.add_argument("-t", "--threshold", type=float, default=2.0,
+                        help="allowed slowdown in percent (default: %(default)s)")
+    args = parser.parse_args()
+
+    current = read_runs(args.current)
+
+    if not os.path.exists(args.baseline):
+        print("No baseline at %s, store %s as the baseline to compare with." % (args.baseline, args.current))
+        return 0
+
+    baseline = read_runs(args.baseline)
+    failures = 0
+
+    for key, base in sorted(baseline.items()):
+        name = "/".join(key)
+        run = current.get(key)
+
+        if run is None:
+            print("%-40s missing" % name)
+            failures += 1
+            continue
+
+        base_ms = float(base["time_ms"])
+        run_ms = float(run["time_ms"])
+        change = (run_ms - base_ms) * 100.0 / base_ms if base_ms else 0.0
+        status = ""
+
+        if run["result"] != "ok":
+            status = run["result"].upper()
+            failures += 1
+        elif change > args.threshold:
+            status = "SLOWER"
+            failures += 1
+        elif change < -args.threshold:
+            status = "faster"
+
+        if status:
+            print("%-40s %10.1f ms -> %10.1f ms (%+6.1f%%) %s" % (name, base_ms, run_ms, change, status))
+
+    for key in sorted(set(current) - set(baseline)):
+        print("%-40s new: %s ms" % ("/".join(key), current[key]["time_ms"]))
+
+    total_base = sum(float(r["time_ms"]) for k, r in baseline.items() if k in current)
+    total_run = sum(float(current[k]["time_ms"]) for k in baseline if k in current)
+
+    if total_base:
+        print("total: %.1f s -> %.1f s (%+.1f%%), %d run(s) failed the comparison"
+              % (total_base / 1000, total_run / 1000, (total_run - total_base) * 100.0 / total_base, failures))
+
+    return 1 if failures else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
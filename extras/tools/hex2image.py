@@ -0,0 +1,237 @@
+#!/usr/bin/env python3
+"""Generate a packed firmware image header from an Intel HEX file.
+
+The input can be a plain .hex file or one of the HexFileImage*.h headers of
+the updater. The output is a header to be selected in HexFileImage.h through
+HEXFILE_PACKED (see Readme.md), holding the segment table, the raw bytes and
+a CRC-32 digest of the whole image (see PackedImage.h for the layout).
+
+The version identity of the image (HexFileImageVersion, the start of the
+banner of its application) is derived from the string table of the image:
+the device name, the version and the build date the application prints
+after "sys reset". It can be given with -v when the image holds no such
+strings. A HexFileImageVersion defined by a HexFileImage*.h input is
+checked against the derived one; --check only does that check.
+
+usage: hex2image.py INPUT [-o OUTPUT] [-n NAME] [-v VERSION] [--check]
+"""
+
+import argparse
+import os
+import re
+import struct
+import sys
+import zlib
+
+DATA_RECORD = 0x00
+END_OF_FILE_RECORD = 0x01
+EXTENDED_SEGMENT_ADDRESS_RECORD = 0x02
+EXTENDED_LINEAR_ADDRESS_RECORD = 0x04
+
+
+BANNER_DEVICE = re.compile(r"RN\d{4}\w*( \w+)?$")
+BANNER_VERSION = re.compile(r"[A-Z]*\d+\.\d+\.\d+\w*$")
+BANNER_DATE = re.compile(r"[A-Z][a-z]{2} [ \d]\d \d{4}$")
+
+
+class HexFormatError(Exception):
+    pass
+
+
+def read_records(path):
+    """Returns the (name, version, records) of the input, records being ':...' strings."""
+    with open(path) as f:
+        text = f.read()
+
+    if path.endswith(".h"):
+        records = re.findall(r'"(:[0-9A-Fa-f]+)"', text)
+        match = re.search(r"#define\s+HexFileImage\s+(\w+)", text)
+        name = match.group(1) if match else None
+        match = re.search(r'#define\s+HexFileImageVersion\s+"([^"]*)"', text)
+        version = match.group(1) if match else None
+    else:
+        records = [line.strip() for line in text.splitlines() if line.strip()]
+        name = None
+        version = None
+
+    if name is None:
+        name = re.sub(r"\W", "_", os.path.splitext(os.path.basename(path))[0])
+
+    return name, version, records
+
+
+def parse_records(records):
+    """Returns a dict of address -> byte, validating every record."""
+    memory = {}
+    extended_address_offset = 0
+    found_end_of_file = False
+
+    for number, record in enumerate(records, 1):
+        if found_end_of_file:
+            raise HexFormatError("line %d: data after the End Of File record" % number)
+
+        if not record.startswith(":") or len(record) < 11 or len(record) % 2 == 0:
+            raise HexFormatError("line %d: malformed record" % number)
+
+        raw = bytes.fromhex(record[1:])
+        length, address, record_type = raw[0], (raw[1] << 8) | raw[2], raw[3]
+        data = raw[4:-1]
+
+        if len(data) != length:
+            raise HexFormatError("line %d: record length mismatch" % number)
+
+        if sum(raw) & 0xFF != 0:
+            raise HexFormatError("line %d: checksum mismatch" % number)
+
+        if record_type == DATA_RECORD:
+            for i, b in enumerate(data):
+                memory[extended_address_offset + address + i] = b
+        elif record_type == EXTENDED_LINEAR_ADDRESS_RECORD:
+            extended_address_offset = ((data[0] << 8) | data[1]) << 16
+        elif record_type == EXTENDED_SEGMENT_ADDRESS_RECORD:
+            extended_address_offset = ((data[0] << 8) | data[1]) * 16
+        elif record_type == END_OF_FILE_RECORD:
+            found_end_of_file = True
+        else:
+            raise HexFormatError("line %d: unsupported record type 0x%02X" % (number, record_type))
+
+    if not found_end_of_file:
+        raise HexFormatError("missing End Of File record")
+
+    return memory
+
+
+def build_segments(memory):
+    """Returns a list of (address, bytes) of the contiguous address ranges."""
+    segments = []
+
+    for address in sorted(memory):
+        if segments and segments[-1][0] + len(segments[-1][1]) == address:
+            segments[-1][1].append(memory[address])
+        else:
+            segments.append((address, bytearray([memory[address]])))
+
+    return segments
+
+
+def image_strings(segments, minimum_length=3):
+    """Returns the runs of printable characters in the image."""
+    strings = []
+
+    for _, data in segments:
+        strings.extend(s.decode("ascii") for s in re.findall(rb"[\x20-\x7E]{%d,}" % minimum_length, bytes(data)))
+
+    return strings
+
+
+def derive_version(segments):
+    """Returns the start of the application banner ("<device> <version> <date>"), or None
+    if the string table of the image doesn't hold exactly one of each."""
+    strings = image_strings(segments)
+    parts = []
+
+    for pattern in (BANNER_DEVICE, BANNER_VERSION, BANNER_DATE):
+        matches = set(s for s in strings if pattern.match(s))
+        if len(matches) != 1:
+            return None
+        parts.append(matches.pop())
+
+    return " ".join(parts)
+
+
+def image_digest(segments):
+    crc = 0
+
+    for address, data in segments:
+        crc = zlib.crc32(struct.pack("<II", address, len(data)), crc)
+        crc = zlib.crc32(bytes(data), crc)
+
+    return crc & 0xFFFFFFFF
+
+
+def write_header(out, name, version, source, segments):
+    guard = "PACKEDFILEIMAGE_%s_H_" % name.upper()
+    data_size = sum(len(data) for _, data in segments)
+
+    out.write("/*\n")
+    out.write(" * Packed firmware image generated by extras/tools/hex2image.py\n")
+    out.write(" * from %s. Do not edit.\n" % os.path.basename(source))
+    out.write(" */\n\n")
+    out.write("#ifndef %s\n#define %s\n\n" % (guard, guard))
+    out.write("#include \"PackedImage.h\"\n\n")
+    out.write("#define HexFileImage %s\n" % name)
+    if version:
+        out.write("#define HexFileImageVersion \"%s\"\n" % version)
+    out.write("\n")
+
+    out.write("const PackedImageSegment %s_Segments[] = {\n" % name)
+    offset = 0
+    for address, data in segments:
+        out.write("    { 0x%08X, %u, %u },\n" % (address, len(data), offset))
+        offset += len(data)
+    out.write("};\n\n")
+
+    out.write("const uint8_t %s_Data[] = {\n" % name)
+    for address, data in segments:
+        out.write("    // 0x%08X\n" % address)
+        for i in range(0, len(data), 16):
+            out.write("    " + ", ".join("0x%02X" % b for b in data[i:i + 16]) + ",\n")
+    out.write("};\n\n")
+
+    out.write("const PackedImage %s = {\n" % name)
+    out.write("    %s_Segments,\n" % name)
+    out.write("    %u,\n" % len(segments))
+    out.write("    %s_Data,\n" % name)
+    out.write("    %u,\n" % data_size)
+    out.write("    0x%08X\n" % image_digest(segments))
+    out.write("};\n\n")
+    out.write("#endif /* %s */\n" % guard)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("input", help="Intel HEX file or HexFileImage*.h header")
+    parser.add_argument("-o", "--output", help="output header (default: PackedFileImage<NAME>.h)")
+    parser.add_argument("-n", "--name", help="image name (default: derived from the input)")
+    parser.add_argument("-v", "--version", help="start of the application banner, e.g. \"RN2483 1.0.5 Oct 31 2018\" "
+                        "(default: derived from the image)")
+    parser.add_argument("--check", action="store_true",
+                        help="only check the HexFileImageVersion of a HexFileImage*.h input against the image")
+    args = parser.parse_args()
+
+    name, defined_version, records = read_records(args.input)
+    name = args.name or name
+
+    try:
+        segments = build_segments(parse_records(records))
+    except HexFormatError as e:
+        sys.exit("%s: %s" % (args.input, e))
+
+    derived_version = derive_version(segments)
+
+    if defined_version is not None and derived_version is not None and defined_version != derived_version:
+        message = "%s: HexFileImageVersion \"%s\" doesn't match the image banner \"%s\"" % (
+            args.input, defined_version, derived_version)
+        if args.check:
+            sys.exit(message)
+        print("warning: " + message, file=sys.stderr)
+
+    if args.check:
+        if derived_version is None:
+            sys.exit("%s: no banner found in the image" % args.input)
+        print("%s: \"%s\"" % (args.input, derived_version))
+        return
+
+    version = args.version or derived_version or defined_version
+
+    output = args.output or "PackedFileImage%s.h" % name
+
+    with open(output, "w") as out:
+        write_header(out, name, version, args.input, segments)
+
+    data_size = sum(len(data) for _, data in segments)
+    print("%s: %u bytes in %u segment(s) -> %s" % (name, data_size, len(segments), output))
+
+
+if __name__ == "__main__":
+    main()